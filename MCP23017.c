@@ -14,20 +14,30 @@
 
 #include "MCP23017.h"
 
-#define Er_Ecriture -1
-#define Er_Lecture -2
-#define Er_Ouverture -3
-#define Er_Fermeture -4
-#define Er_I2C  -5
-#define Er_Expander_Ecriture -10
-#define VERSION_EXPANDER_I2C "1.0"
+_Static_assert(_Alignof(expander_t) == EXPANDER_CACHE_LINE, "expander_t doit etre aligné sur une ligne de cache");
+_Static_assert(sizeof(expander_t) % EXPANDER_CACHE_LINE == 0, "la taille de expander_t doit etre un multiple d'une ligne de cache");
 
 
+static int expander_readShadow(expander_t *exp);
+static int expander_writeOLAT(expander_t *exp, uint8_t val);
+static void expander_settle(expander_t *exp, uint8_t changed);
+static int expander_verifyOLAT(expander_t *exp, uint8_t val);
+static uint64_t expander_now_ns(void);
+static void expander_statOp(expander_t *exp, expander_stat_op_t op, uint64_t t0);
+
+static __thread int expander_thread_prio = -1;     // priorité imposée au thread, -1 : celle de l'expander
+
+// priorité des transferts du thread appelant sur cet expander
+static int expander_effPrio(expander_t *exp){
+
+    return expander_thread_prio >= 0 ? expander_thread_prio : __atomic_load_n(&exp->prio, __ATOMIC_RELAXED);
+}
 
 
 /**
  ** 
  * @brief   ouvre et configure l'interface i2c de la RP, instancie une variable de type expander_t et initialise ses champs dont l'adresse esclave du MCP
+ *          (le descripteur de /dev/i2c-1 est partagé par tous les expanders)
  * 
  * @param   addr adresse en HEXA du MCP23008 (0x__)
  * 
@@ -36,213 +46,1558 @@
  *  
  **/
 expander_t* expander_init(uint8_t addr){
+
+    return expander_initPath(I2C_DEVICE, addr);
+}
+
+
+
+/**
+ ** 
+ * @brief   comme expander_init sur un autre adaptateur, ex: "/dev/i2c-3". Les
+ *          expanders d'adaptateurs differents ont chacun leur bus et leur
+ *          verrou : leurs transferts se font en parallele
+ * 
+ * @param   path chemin de l'adaptateur
+ * @param   addr adresse en HEXA du MCP23008 (0x__)
+ * 
+ * @return  renvoi un pointeur sur la variable instanciée
+ *  
+ **/
+expander_t* expander_initPath(const char *path, uint8_t addr){
+
+    expander_bus_t *bus = expander_bus_open(path);
+    if(bus == NULL)
+        return NULL;
+
+    expander_t *exp = expander_initBus(bus, addr);
+    expander_bus_close(bus);
+    return exp;
+}
+
+
+
+/**
+ ** 
+ * @brief   comme expander_init mais en passant par un transport donné
+ *          (ex: &expander_transport_sim pour travailler sans Raspberry Pi)
+ * 
+ * @param   addr adresse en HEXA du MCP23008 (0x__)
+ * @param   tr transport a utiliser
+ * @param   ctx contexte passé au transport (NULL pour l'i2c-dev)
+ * 
+ * @return  renvoi un pointeur sur la variable instanciée
+ *  
+ **/
+expander_t* expander_initTransport(uint8_t addr, const expander_transport_t *tr, void *ctx){
+
+    if(tr == NULL)
+    {
+        printf("ERREUR %s : transport NULL\n", __func__);
+        return NULL;
+    }
+    expander_bus_t *bus = (tr == &expander_transport_i2cdev) ? expander_bus_open(I2C_DEVICE)
+                                                             : expander_bus_openTransport(tr, ctx);
+    if(bus == NULL)
+        return NULL;
+
+    expander_t *exp = expander_initBus(bus, addr);
+    expander_bus_close(bus);
+    return exp;
+}
+
+
+
+/**
+ ** 
+ * @brief   instancie un expander sur un bus deja ouvert (expander_bus_open), qui
+ *          peut porter plusieurs expanders : l'expander garde une reference sur le bus
+ * 
+ * @param   bus bus sur lequel se trouve le MCP23008
+ * @param   addr adresse en HEXA du MCP23008 (0x__)
+ * 
+ * @return  renvoi un pointeur sur la variable instanciée
+ *  
+ **/
+expander_t* expander_initBus(expander_bus_t *bus, uint8_t addr){
+
+    expander_t* exp = aligned_alloc(EXPANDER_CACHE_LINE, sizeof(expander_t));
+    if (exp == NULL){
+        printf("ERREUR %s : allocation echouee\n", __func__);
+        //exit(EXIT_FAILURE);
+        return NULL;
+    }
+    if(expander_initInPlace(exp, bus, addr) < 0){
+        free(exp);
+        return NULL;
+    }
+    return exp;
+}
+
+
+
+/**
+ ** 
+ * @brief   comme expander_initBus mais dans une memoire fournie par l'appelant
+ *          (ex: tableau d'expander_t contigus, sans allocation). A liberer avec
+ *          expander_deinit, pas expander_closeAndFree
+ * 
+ * @param   exp memoire de l'expander
+ * @param   bus bus sur lequel se trouve le MCP23008
+ * @param   addr adresse en HEXA du MCP23008 (0x__)
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_initInPlace(expander_t *exp, expander_bus_t *bus, uint8_t addr){
     if(addr > 0x27 || addr < 0x20 )
     {
         printf(RED "ERREUR %s : vous avez saisie 0x%02x\nOr addr doit etre entre 0x20 et 0x27 pour l'expander\n" RESET,__func__, addr);
         //exit(EXIT_FAILURE);
-        return NULL;
+        return Er_Expander_Ecriture;
+    }
+    if(exp == NULL || bus == NULL)
+    {
+        printf("ERREUR %s : exp ou bus NULL\n", __func__);
+        return Er_Expander_Ecriture;
     }
-    expander_t* exp = malloc(sizeof(expander_t));
+
+    memset(exp, 0, sizeof(*exp));
+    exp->addr = addr;
+    exp->bus = bus;
+    expander_bus_ref(bus);
+    exp->verify = EXPANDER_VERIFY_NONE;
+    exp->prio = EXPANDER_PRIO_NORMAL;
+    if(bus->tr == &expander_transport_i2cdev)
+        snprintf(exp->path, sizeof(exp->path), "%s", bus->path);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&exp->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    expander_readShadow(exp);
+
+    return 0;
+}
+
+
+
+/**
+ ** 
+ * @brief   comme expander_initBus pour un MCP deja configuré (redemarrage du
+ *          service, sorties sous tension) : la copie locale est prise sur le MCP
+ *          en un seul transfert, sans aucune ecriture, et les fonctions de
+ *          sortie n'ecrivent ensuite que ce qui change sur le MCP. Les pins en
+ *          entree sur le MCP deviennent des pins reservés (exp->inputs = IODIR) :
+ *          les fonctions de sortie ne les repassent jamais en sortie, seul
+ *          expander_setInputPins change cette reservation
+ * 
+ * @param   bus bus sur lequel se trouve le MCP23008
+ * @param   addr adresse en HEXA du MCP23008 (0x__)
+ * 
+ * @return  renvoi un pointeur sur la variable instanciée
+ *  
+ **/
+expander_t* expander_attach(expander_bus_t *bus, uint8_t addr){
+
+    expander_t* exp = aligned_alloc(EXPANDER_CACHE_LINE, sizeof(expander_t));
     if (exp == NULL){
         printf("ERREUR %s : allocation echouee\n", __func__);
-        //exit(EXIT_FAILURE);
         return NULL;
     }
+    if(expander_attachInPlace(exp, bus, addr) < 0){
+        free(exp);
+        return NULL;
+    }
+    return exp;
+}
+
+
+
+/**
+ ** 
+ * @brief   comme expander_attach dans une memoire fournie par l'appelant. Si le
+ *          MCP n'a pas pu etre lu, ou s'il est aux valeurs du reset, l'expander
+ *          se comporte comme apres expander_initInPlace (la premiere sortie
+ *          ecrit IODIR et OLAT)
+ * 
+ * @param   exp memoire de l'expander
+ * @param   bus bus sur lequel se trouve le MCP23008
+ * @param   addr adresse en HEXA du MCP23008 (0x__)
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_attachInPlace(expander_t *exp, expander_bus_t *bus, uint8_t addr){
+
+    int ret = expander_initInPlace(exp, bus, addr);
+    if(ret < 0)
+        return ret;
+
+    // un MCP aux valeurs du reset n'a jamais été configuré : demarrage a froid
+    if(exp->iodir == 0xFF && exp->olat == 0x00 && exp->ipol == 0x00 &&
+       exp->gppu == 0x00 && exp->iocon == 0x00)
+        return 0;
+
+    // les pins deja en entree le restent : rien a reecrire dans IODIR
+    if(exp->erreur == 0){
+        exp->inputs = exp->iodir;
+        exp->warm = 1;
+    }
+    return 0;
+}
+
+
+
+// octets lus par adresse pendant la recherche : IODIR a GPPU, puis OLAT et
+// l'octet suivant (IODIR, le pointeur du MCP23008 repasse a 0x00 apres OLAT).
+// INTF, INTCAP et GPIO ne sont pas lus : aucune interruption n'est acquittée
+#define DISCOVER_LEN    (REG_GPPU + 1 + 2)
+#define DISCOVER_OLAT   (REG_GPPU + 1)
+#define DISCOVER_MSGS   6
+
+/**
+ **
+ * @brief   reconnait un MCP23008 a sa lecture : apres OLAT le pointeur revient
+ *          sur IODIR et les bits 7, 6 et 0 de IOCON n'existent pas (lus a 0).
+ *          Si chaque rafale ne rend qu'une valeur (IOCON.SEQOP a 1, pointeur
+ *          fixe, ou registres tous egaux) IOCON est relu seul
+ *
+ * @return  1 si c'est un MCP23008, 0 sinon
+ *
+ **/
+static int expander_isMCP23008(expander_bus_t *bus, uint8_t addr, const uint8_t *r){
+
+    uint8_t reg = REG_IOCON;
+    uint8_t iocon;
+    int fixe = 1;
+
+    for(int i = 1; i <= REG_GPPU && fixe; i++)
+        fixe = (r[i] == r[0]);
+    if(r[DISCOVER_OLAT + 1] != r[DISCOVER_OLAT])
+        fixe = 0;
+    if(!fixe){
+
+        if(r[DISCOVER_OLAT + 1] != r[MCP23008_IODIR])
+            return 0;
+        return (r[REG_IOCON] & 0xC1) == 0;
+    }
+
+    struct i2c_msg msgs[2] = {
+        { .addr = addr, .flags = 0, .len = 1, .buf = &reg },
+        { .addr = addr, .flags = I2C_M_RD, .len = 1, .buf = &iocon },
+    };
+    if(expander_bus_transfer(bus, msgs, 2) < 0)
+        return 0;
+    return (iocon & 0xC1) == 0;
+}
+
+/**
+ **
+ * @brief   messages de lecture d'une adresse candidate. Par SMBus un octet lu
+ *          apres OLAT serait pris en OLAT+1 (read byte data) : IODIR y est
+ *          relu explicitement et le test du retour du pointeur devient un
+ *          test de relecture
+ *
+ * @return  nombre de messages ecrits dans m
+ *
+ **/
+static int discover_msgs(expander_bus_t *bus, uint8_t addr, uint8_t *r, uint8_t *regs,
+                         uint16_t flags, struct i2c_msg *m){
+
+    int n = 0;
+    int smbus = (bus->method == EXPANDER_METHOD_SMBUS);
+
+    m[n++] = (struct i2c_msg){ .addr = addr, .flags = flags, .len = 1, .buf = &regs[0] };
+    m[n++] = (struct i2c_msg){ .addr = addr, .flags = flags | I2C_M_RD, .len = REG_GPPU + 1, .buf = r };
+    m[n++] = (struct i2c_msg){ .addr = addr, .flags = flags, .len = 1, .buf = &regs[1] };
+    m[n++] = (struct i2c_msg){ .addr = addr, .flags = flags | I2C_M_RD, .len = smbus ? 1 : 2, .buf = r + DISCOVER_OLAT };
+    if(smbus){
+        m[n++] = (struct i2c_msg){ .addr = addr, .flags = flags, .len = 1, .buf = &regs[0] };
+        m[n++] = (struct i2c_msg){ .addr = addr, .flags = flags | I2C_M_RD, .len = 1, .buf = r + DISCOVER_OLAT + 1 };
+    }
+    return n;
+}
+
+/**
+ **
+ * @brief   cherche les MCP23008 presents sur un bus deja ouvert. Si l'adaptateur
+ *          sait ignorer un NACK (I2C_FUNC_PROTOCOL_MANGLING, methode I2C_RDWR)
+ *          toutes les adresses candidates sont lues en un seul transfert avec
+ *          I2C_M_IGNORE_NAK : une adresse absente rend IOCON a 0xFF, valeur
+ *          qu'un MCP23008 ne peut pas rendre. Sinon, ou si ce transfert echoue, chaque
+ *          adresse est lue seule : un NACK interrompt tout le transfert.
+ *          Ni INTF, ni INTCAP, ni GPIO ne sont lus : la recherche peut tourner
+ *          pendant que les interruptions sont servies
+ *
+ * @param   bus bus a parcourir
+ * @param   candidates bit i a 1 pour essayer 0x20+i, 0 pour les 8 adresses
+ * @param   found si non NULL, recoit found[i] = expander initialisé a 0x20+i
+ *          (NULL si absent), a liberer avec expander_closeAndFree
+ *
+ * @return  masque des adresses ou un MCP23008 a été reconnu (et initialisé si
+ *          found est donné), code d'erreur sinon
+ *
+ **/
+int expander_discover(expander_bus_t *bus, uint8_t candidates, expander_t *found[8]){
+
+    uint8_t regs[3] = { MCP23008_IODIR, REG_OLAT, REG_IOCON };
+    uint8_t data[8][DISCOVER_LEN];
+    uint8_t iocon[8];
+    struct i2c_msg msgs[8 * (DISCOVER_MSGS + 2)];
+    uint8_t repond = 0;
+    uint8_t presents = 0;
+    int nmsgs = 0;
+
+    if(bus == NULL)
+    {
+        printf("ERREUR %s : bus NULL\n", __func__);
+        return Er_Lecture;
+    }
+    if(candidates == 0)
+        candidates = 0xFF;
+    if(found != NULL)
+        memset(found, 0, 8 * sizeof(expander_t*));
+
+    if(bus->method == EXPANDER_METHOD_RDWR && (bus->funcs & I2C_FUNC_PROTOCOL_MANGLING)){
+
+        // IOCON relu seul : meme pointeur fixe (SEQOP), il ne vaut jamais 0xFF
+        memset(iocon, 0xFF, sizeof(iocon));
+        for(int i = 0; i < 8; i++){
+
+            if(!(candidates & (1 << i)))
+                continue;
+            nmsgs += discover_msgs(bus, 0x20 + i, data[i], regs, I2C_M_IGNORE_NAK, &msgs[nmsgs]);
+            msgs[nmsgs++] = (struct i2c_msg){ .addr = 0x20 + i, .flags = I2C_M_IGNORE_NAK, .len = 1, .buf = &regs[2] };
+            msgs[nmsgs++] = (struct i2c_msg){ .addr = 0x20 + i, .flags = I2C_M_IGNORE_NAK | I2C_M_RD, .len = 1, .buf = &iocon[i] };
+        }
+        if(expander_bus_transfer(bus, msgs, nmsgs) == 0){
+
+            for(int i = 0; i < 8; i++){
+                if((candidates & (1 << i)) && iocon[i] != 0xFF)
+                    repond |= 1 << i;
+            }
+            candidates = 0;
+        }
+    }
+
+    // lecture adresse par adresse : un absent n'interrompt que son transfert
+    for(int i = 0; i < 8; i++){
+
+        if(!(candidates & (1 << i)))
+            continue;
+        nmsgs = discover_msgs(bus, 0x20 + i, data[i], regs, 0, msgs);
+        if(expander_bus_transfer(bus, msgs, nmsgs) == 0)
+            repond |= 1 << i;
+    }
+
+    for(int i = 0; i < 8; i++){
+
+        if(!(repond & (1 << i)) || !expander_isMCP23008(bus, 0x20 + i, data[i]))
+            continue;
+        if(found != NULL){
+
+            found[i] = expander_initBus(bus, 0x20 + i);
+            if(found[i] == NULL)
+                continue;
+        }
+        presents |= 1 << i;
+    }
+
+#ifdef DEBUG
+    printf("%s : %s, MCP23008 presents 0x%02x (repondent 0x%02x)\n", __func__, bus->path, presents, repond);
+#endif
+    return presents;
+}
+
+
+
+/*
+ labels des pins pour l'affichage console, par adresse (0x20 a 0x27).
+ LES LABELS SONT A CHANGER ICI ou avec expander_setLabels()
+*/
+static const char *expander_labels[8][8] = {
+
+    [0x26 - 0x20] = {
+        "TYPE-2_NL1_ON*---->",
+        "TYPE-2_L2L3_ON*--->",
+        "TYPE-E/F_ON*------>",
+        "LOCK_D*----------->",
+        "RCD_DIS#*--------->",
+        "RCD_TST#*--------->",
+        "RCD_RESET#*------->",
+        "------------------>",
+    },
+    [0x27 - 0x20] = {
+        "LED_DIS#*--------->",
+        "CP_DIS#*---------->",
+        "PP_CS*------------>",
+        "CP_CS*------------>",
+        "T_CS*------------->",
+        "PM_CS*------------>",
+        "PM1*-------------->",
+        "PM0*-------------->",
+    },
+};
+
+/**
+ ** 
+ * @brief   conservée pour compatibilité : les labels ne sont plus copiés dans
+ *          l'expander mais lus dans la table expander_labels
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ *  
+ **/
+void expander_labelize(expander_t* exp){
+
+    (void)exp;
+}
+
+/**
+ ** 
+ * @brief   remplace les labels des pins de l'expander d'adresse addr
+ * 
+ * @param   addr adresse en HEXA du MCP23008 (0x__)
+ * @param   labels 8 chaines (pin 0 a 7), qui doivent rester valides
+ *  
+ **/
+void expander_setLabels(uint8_t addr, const char *labels[8]){
+
+    if(addr < 0x20 || addr > 0x27 || labels == NULL)
+        return;
+    memcpy(expander_labels[addr - 0x20], labels, sizeof(expander_labels[0]));
+}
+
+/**
+ ** 
+ * @brief   renvoie le label d'un pin, "" s'il n'en a pas
+ * 
+ * @param   addr adresse en HEXA du MCP23008 (0x__)
+ * @param   pin le pin en question (entre 0 et 7)
+ *  
+ **/
+const char* expander_getLabel(uint8_t addr, uint8_t pin){
+
+    if(addr < 0x20 || addr > 0x27 || pin > 7 || expander_labels[addr - 0x20][pin] == NULL)
+        return "";
+    return expander_labels[addr - 0x20][pin];
+}
+
+
+
+/**
+ ** 
+ * @brief   rattache l'expander au bus /dev/i2c-1 s'il n'est plus sur aucun bus
+ *          (apres expander_closeI2C)
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * 
+ *  
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_openI2C(expander_t *exp){
+
+    if(exp == NULL || exp == 0)
+    {
+        return Er_Expander_Ecriture;
+        //exit(EXIT_FAILURE);
+    }
+    if(exp->bus != NULL)
+        return 0;
+
+    exp->bus = expander_bus_open(exp->path[0] ? exp->path : I2C_DEVICE);
+    if(exp->bus == NULL) {
+
+        //exit(EXIT_FAILURE);
+        return expander_recordError(exp, Er_Ouverture, 0xFF, __func__);
+    }
+    if(exp->verify == EXPANDER_VERIFY_SCRUB)
+        expander_bus_scrubWatch(exp->bus, exp, 1);
+    return 0;
+}
+
+
+
+/**
+ ** 
+ * @brief   detache l'expander de son bus, le bus est fermé quand plus aucun
+ *          expander ne l'utilise
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * 
+ *  
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_closeI2C(expander_t *exp){
+
+    if(exp == NULL || exp == 0)
+    {
+        //exit(EXIT_FAILURE);
+    return Er_Expander_Ecriture;
+    }
+    expander_bus_scrubWatch(exp->bus, exp, 0);
+    expander_bus_close(exp->bus);
+    exp->bus = NULL;
+    return 0;
+}
+
+
+
+/**
+ ** 
+ * @brief   ne fait plus rien : chaque message i2c porte l'adresse de son
+ *          expander (I2C_RDWR), le bus partagé n'a plus besoin de I2C_SLAVE
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * 
+ *  
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_setI2C(expander_t *exp){
+
+    if(exp == NULL || exp == 0)
+    {
+        //exit(EXIT_FAILURE);
+        return Er_Expander_Ecriture;
+    }
+    return 0;
+}
+
+static uint64_t expander_now_ns(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ ** 
+ * @brief   note une erreur : dernier code dans exp->erreur, compteur de sa
+ *          categorie et entrée dans l'anneau des erreurs (la plus ancienne est
+ *          ecrasée si l'application ne le vide pas). Aucun affichage, sauf en DEBUG
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   code code d'erreur (Er_...)
+ * @param   reg registre concerné, 0xFF si aucun
+ * @param   func fonction ou l'erreur s'est produite
+ * 
+ * @return  code, pour pouvoir ecrire return expander_recordError(...)
+ *  
+ **/
+int expander_recordError(expander_t *exp, int code, uint8_t reg, const char *func){
+
+    expander_lock(exp);
+
+    exp->erreur = code;
+    exp->stats.nb_errors++;
+    if(-code > 0 && -code < EXPANDER_NB_ERR)
+        exp->nb_err[-code]++;
+
+    if(exp->err_count == EXPANDER_ERR_RING){
+        exp->err_head = (exp->err_head + 1) % EXPANDER_ERR_RING;
+        exp->err_count--;
+        exp->nb_err_lost++;
+    }
+
+    expander_err_t *e = &exp->err_ring[(exp->err_head + exp->err_count) % EXPANDER_ERR_RING];
+    e->timestamp_ns = expander_now_ns();
+    e->code = code;
+    e->reg = reg;
+    e->func = func;
+    exp->err_count++;
+
+    pthread_mutex_unlock(&exp->lock);
+
+#ifdef DEBUG
+    fprintf(stderr, "expander 0x%02x : erreur %d registre 0x%02x dans %s\n", exp->addr, code, reg, func);
+#endif
+    return code;
+}
+
+/**
+ ** 
+ * @brief   retire l'erreur la plus ancienne de l'anneau, a appeler au rythme
+ *          de l'application
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   err recoit l'erreur
+ * 
+ * @return  1 si une erreur a ete rendue, 0 si l'anneau est vide
+ *  
+ **/
+int expander_popError(expander_t *exp, expander_err_t *err){
+
+    int ret = 0;
+
+    if(exp == NULL || err == NULL)
+        return 0;
+
+    expander_lock(exp);
+    if(exp->err_count > 0){
+        *err = exp->err_ring[exp->err_head];
+        exp->err_head = (exp->err_head + 1) % EXPANDER_ERR_RING;
+        exp->err_count--;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&exp->lock);
+    return ret;
+}
+
+/**
+ ** 
+ * @brief   remet a zero les compteurs d'erreurs, l'anneau et exp->erreur
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ *  
+ **/
+void expander_clearErrors(expander_t *exp){
+
+    if(exp == NULL)
+        return;
+
+    expander_lock(exp);
+    exp->erreur = 0;
+    memset(exp->nb_err, 0, sizeof(exp->nb_err));
+    exp->nb_err_lost = 0;
+    exp->err_head = 0;
+    exp->err_count = 0;
+    pthread_mutex_unlock(&exp->lock);
+}
+
+/**
+ ** 
+ * @brief   ajoute la duree depuis t0 aux mesures de l'operation op
+ *          (appelée avec le verrou de l'expander)
+ *  
+ **/
+static void expander_statOp(expander_t *exp, expander_stat_op_t op, uint64_t t0){
+
+    uint64_t ns = expander_now_ns() - t0;
+    uint64_t us = ns / 1000;
+    int b = (us == 0) ? 0 : 64 - __builtin_clzll(us);
+
+    if(b >= EXPANDER_STAT_NB_BUCKETS)
+        b = EXPANDER_STAT_NB_BUCKETS - 1;
+
+    exp->stats.nb_op[op]++;
+    exp->stats.sum_ns[op] += ns;
+    if(ns > exp->stats.max_ns[op])
+        exp->stats.max_ns[op] = ns;
+    exp->stats.hist[op][b]++;
+}
+
+/**
+ ** 
+ * @brief   copie les mesures de l'expander
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   st recoit les mesures
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_getStats(expander_t *exp, expander_stats_t *st){
+
+    if(exp == NULL || st == NULL)
+        return Er_Expander_Ecriture;
+
+    expander_lock(exp);
+    *st = exp->stats;
+    pthread_mutex_unlock(&exp->lock);
+    return 0;
+}
+
+/**
+ ** 
+ * @brief   remet a zero les mesures de l'expander
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ *  
+ **/
+void expander_resetStats(expander_t *exp){
+
+    if(exp == NULL)
+        return;
+
+    expander_lock(exp);
+    memset(&exp->stats, 0, sizeof(exp->stats));
+    pthread_mutex_unlock(&exp->lock);
+}
+
+/**
+ ** 
+ * @brief   borne superieure, en us, du seau de l'histogramme qui contient le
+ *          percentile p (ex: 0.99) des latences de op
+ * 
+ * @param   st mesures (expander_getStats)
+ * @param   op operation
+ * @param   p percentile entre 0 et 1
+ * 
+ * @return  borne en us, 0 si aucune mesure
+ *  
+ **/
+uint64_t expander_statPercentile(const expander_stats_t *st, expander_stat_op_t op, double p){
+
+    uint64_t cumul = 0;
+
+    if(st == NULL || op >= EXPANDER_STAT_NB_OP || st->nb_op[op] == 0)
+        return 0;
+
+    uint64_t rang = (uint64_t)(p * st->nb_op[op]);
+    if(rang >= st->nb_op[op])
+        rang = st->nb_op[op] - 1;
+
+    for(int b = 0; b < EXPANDER_STAT_NB_BUCKETS; b++){
+        cumul += st->hist[op][b];
+        if(cumul > rang)
+            return 1ull << b;
+    }
+    return 1ull << (EXPANDER_STAT_NB_BUCKETS - 1);
+}
+
+/**
+ ** 
+ * @brief   attend la fin de l'ecart minimum entre transferts de l'expander
+ *          (timing.gap_us). Verrou de l'expander tenu
+ *  
+ **/
+static void expander_gap(expander_t *exp){
+
+    if(exp->timing.gap_us && exp->last_xfer_ns){
+
+        uint64_t t = exp->last_xfer_ns + (uint64_t)exp->timing.gap_us * 1000;
+        struct timespec ts = { .tv_sec = t / 1000000000ull, .tv_nsec = t % 1000000000ull };
+
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    }
+}
+
+/**
+ ** 
+ * @brief   compte dans les mesures de l'expander ses messages d'un transfert
+ *          (owner NULL : tous, sinon ceux ou owner[i] == exp) et note l'echec
+ *          comme lecture ou ecriture. Verrou de l'expander tenu
+ * 
+ * @return  ret si ok, code d'erreur noté sinon
+ *  
+ **/
+static int expander_account(expander_t *exp, expander_t *const *owner, const struct i2c_msg *msgs,
+                            int nmsgs, uint64_t t0, int ret){
+
+    int lecture = 0, n = 0;
+    int code = Er_Ecriture;
+    uint8_t reg = 0xFF;
+
+    exp->last_xfer_ns = expander_now_ns();
+
+    for(int i = 0; i < nmsgs; i++){
+
+        if(owner != NULL && owner[i] != exp)
+            continue;
+        n++;
+        exp->stats.nb_bytes += msgs[i].len;
+        lecture |= msgs[i].flags & I2C_M_RD;
+
+        // lecture si l'un des messages lit, registre = premier octet ecrit
+        if(msgs[i].flags & I2C_M_RD)
+            code = Er_Lecture;
+        else if(reg == 0xFF && msgs[i].len > 0)
+            reg = msgs[i].buf[0];
+    }
+    exp->stats.nb_xfer++;
+    exp->stats.nb_msgs += n;
+    expander_statOp(exp, lecture ? EXPANDER_STAT_READ : EXPANDER_STAT_WRITE, t0);
+
+    if(ret >= 0)
+        return ret;
+    if(exp->bus == NULL)
+        code = Er_I2C;
+    return expander_recordError(exp, code, reg, __func__);
+}
+
+/**
+ ** 
+ * @brief   passe des messages au bus en respectant l'ecart minimum
+ *          entre transferts de la politique de temporisation. Le verrou du bus
+ *          n'est tenu que pendant le transfert, pas pendant l'attente. Un echec
+ *          est noté (expander_recordError) comme lecture ou ecriture
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   msgs messages a transferer
+ * @param   nmsgs nombre de messages
+ * 
+ * @return  0 si ok, <0 sinon
+ *  
+ **/
+int expander_transfer(expander_t *exp, struct i2c_msg *msgs, int nmsgs){
+
+    expander_lock(exp);
+    expander_gap(exp);
+
+    int ret = Er_I2C;
+    uint64_t t0 = expander_now_ns();
+
+    if(exp->bus != NULL)
+        ret = expander_bus_transferInherit(exp->bus, msgs, nmsgs, expander_effPrio(exp), &exp->inherit);
+
+    ret = expander_account(exp, NULL, msgs, nmsgs, t0, ret);
+    pthread_mutex_unlock(&exp->lock);
+    return ret;
+}
+
+/**
+ ** 
+ * @brief   ordre de verrouillage des expanders : par adresse en memoire, comme
+ *          expander_batch_update
+ *  
+ **/
+static int expander_ptrCmp(const void *a, const void *b){
+
+    uintptr_t x = (uintptr_t)*(expander_t *const *)a, y = (uintptr_t)*(expander_t *const *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ ** 
+ * @brief   comme expander_transfer pour des messages destinés a plusieurs
+ *          expanders du meme bus, en un seul transfert (expander_batch_flush).
+ *          Les expanders sont verrouillés dans l'ordre de leurs adresses en
+ *          memoire, l'ecart minimum de chacun est respecté, le transfert prend
+ *          la plus haute de leurs priorités et chaque expander compte ses
+ *          messages dans ses mesures (et l'echec dans ses erreurs)
+ * 
+ * @param   owner owner[i] expander destinataire de msgs[i]
+ * @param   msgs messages a transferer
+ * @param   nmsgs nombre de messages (I2C_RDWR_IOCTL_MAX_MSGS au plus)
+ * 
+ * @return  0 si ok, <0 sinon
+ *  
+ **/
+int expander_transferMany(expander_t *const *owner, struct i2c_msg *msgs, int nmsgs){
+
+    expander_t *exps[I2C_RDWR_IOCTL_MAX_MSGS];
+    int nexp = 0, prio = EXPANDER_PRIO_BACKGROUND;
+    int ret = Er_I2C, err = 0;
+
+    if(owner == NULL || msgs == NULL || nmsgs <= 0 || nmsgs > I2C_RDWR_IOCTL_MAX_MSGS)
+        return Er_Expander_Ecriture;
+
+    for(int i = 0; i < nmsgs; i++){
+
+        int j = 0;
+        while(j < nexp && exps[j] != owner[i])
+            j++;
+        if(j == nexp)
+            exps[nexp++] = owner[i];
+    }
+    for(int k = 0; k < nexp; k++){
+        if(exps[k] == NULL || exps[k]->bus != exps[0]->bus)
+            return Er_I2C;
+    }
+
+    // toujours dans le meme ordre : pas d'interblocage avec un autre lot
+    qsort(exps, nexp, sizeof(expander_t*), expander_ptrCmp);
+    for(int k = 0; k < nexp; k++){
+
+        expander_lock(exps[k]);
+        expander_gap(exps[k]);
+        if(expander_effPrio(exps[k]) > prio)
+            prio = expander_effPrio(exps[k]);
+    }
+
+    uint64_t t0 = expander_now_ns();
+
+    if(exps[0]->bus != NULL)
+        ret = expander_bus_transferPrio(exps[0]->bus, msgs, nmsgs, prio);
+
+    for(int k = 0; k < nexp; k++){
+
+        int r = expander_account(exps[k], owner, msgs, nmsgs, t0, ret);
+        if(r < 0 && err == 0)
+            err = r;
+    }
+    for(int k = nexp - 1; k >= 0; k--)
+        pthread_mutex_unlock(&exps[k]->lock);
+    return ret < 0 ? err : 0;
+}
+
+/**
+ ** 
+ * @brief   attend settle_us si l'un des pins modifiés fait partie de settle_mask
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   changed pins dont l'etat vient de changer
+ *  
+ **/
+static void expander_settle(expander_t *exp, uint8_t changed){
+
+    if(exp->timing.settle_us && (changed & exp->timing.settle_mask))
+        usleep(exp->timing.settle_us);
+}
+
+/**
+ ** 
+ * @brief   reporte dans la copie locale une ecriture reussie sur un registre
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   reg registre ecrit
+ * @param   val valeur ecrite
+ *  
+ **/
+void expander_updateShadow(expander_t *exp, uint8_t reg, uint8_t val){
+
+    expander_lock(exp);
+    switch(reg){
+
+        case MCP23008_IODIR:    exp->iodir = val;   break;
+        case MCP23008_IPOL:     exp->ipol = val;    break;
+        case REG_IOCON:         exp->iocon = val;   break;
+        case REG_GPPU:          exp->gppu = val;    break;
+        case REG_GPIO:          // une ecriture sur GPIO modifie OLAT
+        case REG_OLAT:          exp->olat = val;    break;
+        default:                                    break;
+    }
+    pthread_mutex_unlock(&exp->lock);
+}
+
+/**
+ ** 
+ * @brief   ecrit un registre de l'expander
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   reg registre a ecrire
+ * @param   val valeur a ecrire
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_writeRegister(expander_t *exp, uint8_t reg, uint8_t val){
+
+    struct i2c_msg msg;
+    uint8_t buf[2] = { reg, val };
+
+    msg.addr = exp->addr;
+    msg.flags = 0;
+    msg.len = 2;
+    msg.buf = buf;
+
+    // la copie locale doit suivre le transfert sans qu'un autre thread s'intercale
+    expander_lock(exp);
+    if(expander_transfer(exp, &msg, 1) < 0) {
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Ecriture;
+    }
+    expander_updateShadow(exp, reg, val);
+    pthread_mutex_unlock(&exp->lock);
+    return 0;
+}
+
+/**
+ ** 
+ * @brief   lit un registre de l'expander : selection du registre et lecture
+ *          en un seul transfert (repeated start, pas de STOP entre les deux)
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   reg registre a lire
+ * @param   val recoit la valeur lue
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_readRegister(expander_t *exp, uint8_t reg, uint8_t *val){
+
+    struct i2c_msg msgs[2];
+    uint8_t buf[2] = { reg, 0 };
+
+    msgs[0].addr = exp->addr;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &buf[0];
+
+    msgs[1].addr = exp->addr;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = 1;
+    msgs[1].buf = &buf[1];
+
+    if(expander_transfer(exp, msgs, 2) < 0) {
+        return Er_Lecture;
+    }
+    *val = buf[1];
+    return 0;
+}
+
+/**
+ ** 
+ * @brief   repasse le MCP en mode sequentiel (IOCON.SEQOP a 0) si besoin, pour
+ *          que le pointeur d'adresse avance a chaque octet d'une rafale
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+static int expander_seqMode(expander_t *exp){
+
+    if(!(exp->iocon & IOCON_SEQOP))
+        return 0;
+    return expander_writeRegister(exp, REG_IOCON, exp->iocon & ~IOCON_SEQOP);
+}
+
+/**
+ ** 
+ * @brief   lit n registres consecutifs a partir de reg en un seul transfert
+ *          (mode sequentiel). Attention : lire GPIO ou INTCAP acquitte l'interruption
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   reg premier registre a lire
+ * @param   val recoit les n valeurs lues
+ * @param   n nombre de registres (reg + n <= EXPANDER_NB_REG)
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_readRegisters(expander_t *exp, uint8_t reg, uint8_t *val, int n){
+
+    struct i2c_msg msgs[2];
+    uint8_t r = reg;
+
+    if(n <= 0 || reg + n > EXPANDER_NB_REG)
+        return Er_Lecture;
+
+    expander_lock(exp);
+    if(n > 1 && expander_seqMode(exp) < 0){
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Lecture;
+    }
+
+    msgs[0].addr = exp->addr;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &r;
+
+    msgs[1].addr = exp->addr;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = n;
+    msgs[1].buf = val;
+
+    if(expander_transfer(exp, msgs, 2) < 0) {
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Lecture;
+    }
+    for(int i = 0; i < n; i++){
+        if(reg + i != REG_GPIO)
+            expander_updateShadow(exp, reg + i, val[i]);
+    }
+    pthread_mutex_unlock(&exp->lock);
+    return 0;
+}
+
+/**
+ ** 
+ * @brief   ecrit n registres consecutifs a partir de reg en un seul transfert
+ *          (mode sequentiel). Une valeur de IOCON avec SEQOP a 1 n'est acceptée
+ *          qu'en dernier registre, sinon la suite de la rafale irait dans IOCON
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   reg premier registre a ecrire
+ * @param   val les n valeurs a ecrire
+ * @param   n nombre de registres (reg + n <= EXPANDER_NB_REG)
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_writeRegisters(expander_t *exp, uint8_t reg, const uint8_t *val, int n){
+
+    struct i2c_msg msg;
+    uint8_t buf[EXPANDER_NB_REG + 1];
+
+    if(n <= 0 || reg + n > EXPANDER_NB_REG)
+        return Er_Ecriture;
+    if(reg <= REG_IOCON && reg + n - 1 > REG_IOCON && (val[REG_IOCON - reg] & IOCON_SEQOP))
+        return Er_Ecriture;
+
+    expander_lock(exp);
+    if(n > 1 && expander_seqMode(exp) < 0){
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Ecriture;
+    }
+
+    buf[0] = reg;
+    memcpy(&buf[1], val, n);
+
+    msg.addr = exp->addr;
+    msg.flags = 0;
+    msg.len = n + 1;
+    msg.buf = buf;
+
+    if(expander_transfer(exp, &msg, 1) < 0) {
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Ecriture;
+    }
+    for(int i = 0; i < n; i++)
+        expander_updateShadow(exp, reg + i, val[i]);
+    pthread_mutex_unlock(&exp->lock);
+    return 0;
+}
+
+/**
+ ** 
+ * @brief   lit l'etat complet du MCP (registres 0x00 a 0x0A) en un seul transfert
+ *          et remet a jour la copie locale. Acquitte une interruption en cours
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   st recoit l'etat
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_snapshot(expander_t *exp, expander_state_t *st){
+
+    if(exp == NULL || st == NULL)
+        return Er_Lecture;
+    return expander_readRegisters(exp, MCP23008_IODIR, st->reg, EXPANDER_NB_REG);
+}
+
+/**
+ ** 
+ * @brief   remet le MCP dans l'etat st en un seul transfert : OLAT d'abord pour
+ *          que les pins repassant en sortie prennent directement leur valeur,
+ *          puis IODIR a GPPU en rafale. INTF, INTCAP et GPIO ne s'ecrivent pas.
+ *          Si st a SEQOP a 1, IOCON est reecrit a la fin dans un message a part
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   st etat a restaurer (issu de expander_snapshot)
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *  
+ **/
+int expander_restore(expander_t *exp, const expander_state_t *st){
+
+    struct i2c_msg msgs[3];
+    uint8_t olat[2], regs[REG_GPPU + 2], iocon[2];
+    int nmsgs = 2;
+
+    if(exp == NULL || st == NULL)
+        return Er_Ecriture;
+
+    expander_lock(exp);
+    if(expander_seqMode(exp) < 0){
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Ecriture;
+    }
+
+    olat[0] = REG_OLAT;
+    olat[1] = st->reg[REG_OLAT];
+
+    regs[0] = MCP23008_IODIR;
+    memcpy(&regs[1], st->reg, REG_GPPU + 1);
+    regs[1 + REG_IOCON] &= ~IOCON_SEQOP;
+
+    iocon[0] = REG_IOCON;
+    iocon[1] = st->reg[REG_IOCON];
+
+    msgs[0].addr = exp->addr;
+    msgs[0].flags = 0;
+    msgs[0].len = sizeof(olat);
+    msgs[0].buf = olat;
+
+    msgs[1].addr = exp->addr;
+    msgs[1].flags = 0;
+    msgs[1].len = sizeof(regs);
+    msgs[1].buf = regs;
+
+    if(iocon[1] & IOCON_SEQOP){
+        msgs[2].addr = exp->addr;
+        msgs[2].flags = 0;
+        msgs[2].len = sizeof(iocon);
+        msgs[2].buf = iocon;
+        nmsgs = 3;
+    }
+
+    if(expander_transfer(exp, msgs, nmsgs) < 0) {
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Ecriture;
+    }
+    for(int i = MCP23008_IODIR; i <= REG_GPPU; i++)
+        expander_updateShadow(exp, i, st->reg[i]);
+    expander_updateShadow(exp, REG_OLAT, st->reg[REG_OLAT]);
+    pthread_mutex_unlock(&exp->lock);
+    return 0;
+}
+
+/**
+ ** 
+ * @brief   remplit la copie locale des registres IOCON, IODIR, IPOL, GPPU et OLAT
+ *          a partir de l'etat reel du MCP, en un seul transfert et sans aucune
+ *          ecriture. INTF, INTCAP et GPIO ne sont pas lus : une interruption en
+ *          attente n'est pas acquittée
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * 
+ * @return  0 si ok, code d'erreur sinon (copie locale aux valeurs du reset)
+ *  
+ **/
+static int expander_readShadow(expander_t *exp){
+
+    uint8_t r_iocon = REG_IOCON, r_iodir = MCP23008_IODIR, r_olat = REG_OLAT;
+    uint8_t r_ipol = MCP23008_IPOL, r_gppu = REG_GPPU;
+    uint8_t regs[REG_GPPU + 1];
+    uint8_t iocon, olat;
+
+    // valeurs au reset du MCP23008 si la lecture echoue
+    exp->iodir = 0xFF;
+    exp->ipol = 0x00;
+    exp->gppu = 0x00;
+    exp->olat = 0x00;
+    exp->iocon = 0x00;
+
+    // IOCON en tete : il dit si la rafale IODIR..GPPU a avancé (SEQOP a 0)
+    struct i2c_msg msgs[6] = {
+        { .addr = exp->addr, .flags = 0,        .len = 1,            .buf = &r_iocon },
+        { .addr = exp->addr, .flags = I2C_M_RD, .len = 1,            .buf = &iocon },
+        { .addr = exp->addr, .flags = 0,        .len = 1,            .buf = &r_iodir },
+        { .addr = exp->addr, .flags = I2C_M_RD, .len = REG_GPPU + 1, .buf = regs },
+        { .addr = exp->addr, .flags = 0,        .len = 1,            .buf = &r_olat },
+        { .addr = exp->addr, .flags = I2C_M_RD, .len = 1,            .buf = &olat },
+    };
+
+    if(expander_transfer(exp, msgs, 6) < 0)
+        goto erreur;
+
+    if(iocon & IOCON_SEQOP){
+
+        // pointeur fixe : la rafale n'a lu que IODIR, IOCON n'est pas modifié ici
+        struct i2c_msg seuls[4] = {
+            { .addr = exp->addr, .flags = 0,        .len = 1, .buf = &r_ipol },
+            { .addr = exp->addr, .flags = I2C_M_RD, .len = 1, .buf = &regs[MCP23008_IPOL] },
+            { .addr = exp->addr, .flags = 0,        .len = 1, .buf = &r_gppu },
+            { .addr = exp->addr, .flags = I2C_M_RD, .len = 1, .buf = &regs[REG_GPPU] },
+        };
+        if(expander_transfer(exp, seuls, 4) < 0)
+            goto erreur;
+    }
 
+    exp->iodir = regs[MCP23008_IODIR];
+    exp->ipol = regs[MCP23008_IPOL];
+    exp->gppu = regs[REG_GPPU];
+    exp->iocon = iocon;
+    exp->olat = olat;
+    return 0;
 
-    exp->addr = addr;
-    exp->erreur = 0;
-    expander_labelize(exp);
-    expander_openI2C(exp);
-    expander_setI2C(exp);
-
-    usleep(1);
-    return exp;
+erreur:
+    return expander_recordError(exp, Er_Lecture, 0xFF, __func__);
 }
 
+/**
+ ** 
+ * @brief   relit OLAT apres une ecriture (EXPANDER_VERIFY_OLAT). En cas de
+ *          difference IODIR et OLAT sont reecrits une seule fois puis relus
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   val valeur attendue dans OLAT
+ * 
+ * @return  0 si ok (eventuellement apres reecriture), code d'erreur sinon
+ *  
+ **/
+static int expander_verifyOLAT(expander_t *exp, uint8_t val){
+
+    uint8_t olat;
+
+    if(expander_readRegister(exp, REG_OLAT, &olat) < 0)
+        return Er_Lecture;
+    if(olat == val)
+        return 0;
 
+    exp->stats.nb_verify_mismatch++;
+    exp->stats.nb_retries++;
+    if(expander_writeRegister(exp, MCP23008_IODIR, exp->inputs) < 0 ||
+       expander_writeRegister(exp, REG_OLAT, val) < 0)
+        return Er_Ecriture;
 
+    if(expander_readRegister(exp, REG_OLAT, &olat) < 0)
+        return Er_Lecture;
+    if(olat == val)
+        return 0;
 
+    return expander_recordError(exp, Er_Expander_Ecriture, REG_OLAT, __func__);
+}
 
 /**
  ** 
- * @brief   definit le champs label qui associera un nom a chaque pin GPIO pour la console
+ * @brief   passe en sortie les pins qui ne sont pas reservés en entree si besoin
+ *          puis ecrit OLAT : une seule ecriture quand IODIR est deja a jour
+ *          dans la copie locale, suivie d'une relecture de OLAT si la politique
+ *          de verification le demande
  * 
  * @param   exp pointeur sur variable structuré de l'expander
+ * @param   val nouvelle valeur de OLAT
  * 
+ * @return  0 si ok, code d'erreur sinon
  *  
  **/
-void expander_labelize(expander_t* exp){
-
-    if(exp == NULL || exp == 0)
-    {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-        //exit(EXIT_FAILURE);
-        return;
-    }
-    if(exp->addr == 0x26){
+static int expander_writeOLAT(expander_t *exp, uint8_t val){
 
-        strcpy(exp->label[0],"TYPE-2_NL1_ON*---->");
-        strcpy(exp->label[1],"TYPE-2_L2L3_ON*--->");
-        strcpy(exp->label[2],"TYPE-E/F_ON*------>");
-        strcpy(exp->label[3],"LOCK_D*----------->");
-        strcpy(exp->label[4],"RCD_DIS#*--------->");
-        strcpy(exp->label[5],"RCD_TST#*--------->");
-        strcpy(exp->label[6],"RCD_RESET#*------->");
-        strcpy(exp->label[7],"------------------>");
+    uint8_t changed = (exp->olat ^ val) | (exp->iodir & ~exp->inputs);
+    uint64_t t0 = expander_now_ns();
+    int ret = 0;
 
-    }
-    else if(exp->addr == 0x27){
+    // expander_attach : la copie locale vient du MCP, rien a ecrire s'il ne change pas
+    if(exp->warm && changed == 0)
+        return 0;
 
-        strcpy(exp->label[0],"LED_DIS#*--------->");
-        strcpy(exp->label[1],"CP_DIS#*---------->");
-        strcpy(exp->label[2],"PP_CS*------------>");
-        strcpy(exp->label[3],"CP_CS*------------>");
-        strcpy(exp->label[4],"T_CS*------------->");
-        strcpy(exp->label[5],"PM_CS*------------>");
-        strcpy(exp->label[6],"PM1*-------------->");
-        strcpy(exp->label[7],"PM0*-------------->");
-    }
-    else{
+    if(exp->iodir != exp->inputs){
 
-        strcpy(exp->label[0],"");
-        strcpy(exp->label[1],"");
-        strcpy(exp->label[2],"");
-        strcpy(exp->label[3],"");
-        strcpy(exp->label[4],"");
-        strcpy(exp->label[5],"");
-        strcpy(exp->label[6],"");
-        strcpy(exp->label[7],"");
+        if(expander_writeRegister(exp, MCP23008_IODIR, exp->inputs) < 0)
+            return Er_Ecriture;
     }
 
-
+#ifdef DEBUG
+    printf("ecriture sur OLAT de 0x%02x...\n", val);
+#endif
+
+    if(expander_writeRegister(exp, REG_OLAT, val) < 0)
+        return Er_Ecriture;
+    if(exp->verify == EXPANDER_VERIFY_OLAT)
+        ret = expander_verifyOLAT(exp, val);
+    expander_settle(exp, changed);
+    expander_statOp(exp, EXPANDER_STAT_OUTPUT, t0);
+    return ret;
 }
 
-
-
 /**
  ** 
- * @brief   ouvre l'interface i2c de la RP
+ * @brief   configure les pullUp des gpio
  * 
  * @param   exp pointeur sur variable structuré de l'expander
+ * @param   val valeur des pull up en HEXA
+ *
  * 
- *  
- **/
-void expander_openI2C(expander_t *exp){
+ * @return  0 si ok, code d'erreur sinon
+ *
+ *  **/
+int expander_setPullup(expander_t * exp, uint8_t val){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-        return;
-        //exit(EXIT_FAILURE);
+       // exit(EXIT_FAILURE);
+        return Er_Expander_Ecriture;
     }
-    exp->fd = open(I2C_DEVICE, O_RDWR);
-    if(exp->fd < 0) {
-
-        printf("Warning fonction %s : pas pu ouvrir l'i2c on retente apres 1sec\n", __func__);
-        sleep(1);
+    
+    // comparaison et ecriture sous le verrou, comme pour OLAT
+    expander_lock(exp);
+    int ret = 0;
+    if(!exp->warm || val != exp->gppu)
+        ret = expander_writeRegister(exp, REG_GPPU, val);  // pull up activé
+    pthread_mutex_unlock(&exp->lock);
+    return ret;
+}
 
-        exp->fd = open(I2C_DEVICE, O_RDWR);
-        if(exp->fd < 0) {
-        
-            fprintf(stderr, "fonction %s: Unable to open i2c device: %s\n", __func__, strerror(errno));
-            exp->erreur = Er_Ouverture;
+/**
+ ** 
+ * @brief   change la politique de temporisation de l'expander
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   timing nouvelle politique, NULL pour revenir a aucune attente
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ *  **/
+int expander_setTiming(expander_t *exp, const expander_timing_t *timing){
 
-            //exit(EXIT_FAILURE);
-            return;
-        }
-        
+    if(exp == NULL || exp == 0)
+    {
+        return Er_Expander_Ecriture;
     }
-}
-
 
+    expander_lock(exp);
+    if(timing == NULL)
+        memset(&exp->timing, 0, sizeof(exp->timing));
+    else
+        exp->timing = *timing;
+    pthread_mutex_unlock(&exp->lock);
+    return 0;
+}
 
 /**
  ** 
- * @brief   ferme l'interface i2c de la RP
+ * @brief   change la politique de verification des ecritures de sortie
  * 
  * @param   exp pointeur sur variable structuré de l'expander
- * 
- *  
- **/
-void expander_closeI2C(expander_t *exp){
+ * @param   mode EXPANDER_VERIFY_NONE, EXPANDER_VERIFY_OLAT ou EXPANDER_VERIFY_SCRUB
+ *          (controle par le thread du bus, expander_bus_setScrubPeriod)
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ *  **/
+int expander_setVerify(expander_t *exp, expander_verify_t mode){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
-        //exit(EXIT_FAILURE);
-    return;
+        return Er_Expander_Ecriture;
     }
-    if(close(exp->fd) < 0) {
 
-        fprintf(stderr, "fonction %s: Unable to close i2c device: %s\n", __func__, strerror(errno));
-        exp->erreur = Er_Fermeture;
-        //exit(EXIT_FAILURE);
-        return;
-    }
+    expander_lock(exp);
+    exp->verify = mode;
+    pthread_mutex_unlock(&exp->lock);
+
+    expander_bus_scrubWatch(exp->bus, exp, mode == EXPANDER_VERIFY_SCRUB);
+    return 0;
+}
+
+/**
+ ** 
+ * @brief   change la priorité des transferts de l'expander sur son bus
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   prio EXPANDER_PRIO_BACKGROUND a EXPANDER_PRIO_CRITICAL
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ *  **/
+int expander_setPriority(expander_t *exp, expander_prio_t prio){
+
+    if(exp == NULL || prio >= EXPANDER_NB_PRIO)
+        return Er_Expander_Ecriture;
+
+    expander_lock(exp);
+    __atomic_store_n(&exp->prio, prio, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&exp->lock);
+    return 0;
 }
 
+/**
+ ** 
+ * @brief   impose une priorité a tous les transferts du thread appelant, quel
+ *          que soit l'expander (ex: thread de diagnostic en EXPANDER_PRIO_BACKGROUND)
+ * 
+ * @param   prio priorité, -1 pour revenir a celle de chaque expander
+ *
+ *  **/
+void expander_setThreadPriority(int prio){
 
+    expander_thread_prio = (prio >= EXPANDER_NB_PRIO) ? EXPANDER_PRIO_CRITICAL : prio;
+}
 
 /**
  ** 
- * @brief   configure l'interface i2c, et lui fait connaitre l'adresse de l'expander
+ * @brief   relit IODIR..GPPU et OLAT en un seul transfert, sans toucher a GPIO ni
+ *          INTCAP (les interruptions ne sont pas acquittées), et reecrit chaque
+ *          registre qui ne correspond plus a la copie locale (ex: MCP
+ *          reinitialisé par une chute d'alimentation). Appelée periodiquement
+ *          par le thread du bus en mode EXPANDER_VERIFY_SCRUB
  * 
  * @param   exp pointeur sur variable structuré de l'expander
  * 
+ * @return  nombre de registres reparés, code d'erreur sinon
  *  
  **/
-void expander_setI2C(expander_t *exp){
-
-    if(exp == NULL || exp == 0)
-    {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
-        //exit(EXIT_FAILURE);
-        return;
-    }   
+int expander_scrub(expander_t *exp){
+
+    struct i2c_msg msgs[4];
+    uint8_t sel[2] = { MCP23008_IODIR, REG_OLAT };
+    uint8_t regs[REG_GPPU + 1], olat;
+    int repares = 0;
+    uint64_t t0;
+
+    if(exp == NULL)
+        return Er_Lecture;
+
+    t0 = expander_now_ns();
+    expander_lock(exp);
+    if(expander_seqMode(exp) < 0){
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Lecture;
+    }
 
-    if(ioctl(exp->fd,I2C_SLAVE,exp->addr) < 0) {
-        printf("ERREUR de setting de l'address l'interface I2C de la RPZ ...\n");
-        close(exp->fd);
-        exp->erreur = Er_I2C;
-        //exit(EXIT_FAILURE);
-        return;
+    msgs[0].addr = exp->addr;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &sel[0];
+
+    msgs[1].addr = exp->addr;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = sizeof(regs);
+    msgs[1].buf = regs;
+
+    msgs[2].addr = exp->addr;
+    msgs[2].flags = 0;
+    msgs[2].len = 1;
+    msgs[2].buf = &sel[1];
+
+    msgs[3].addr = exp->addr;
+    msgs[3].flags = I2C_M_RD;
+    msgs[3].len = 1;
+    msgs[3].buf = &olat;
+
+    if(expander_transfer(exp, msgs, 4) < 0) {
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Lecture;
     }
 
+    // OLAT avant IODIR : les pins qui repassent en sortie prennent la bonne valeur
+    const struct { uint8_t reg, lu, attendu; } cmp[] = {
+        { REG_OLAT,         olat,                   exp->olat },
+        { REG_IOCON,        regs[REG_IOCON],        exp->iocon },
+        { MCP23008_IODIR,   regs[MCP23008_IODIR],   exp->iodir },
+        { MCP23008_IPOL,    regs[MCP23008_IPOL],    exp->ipol },
+        { REG_GPPU,         regs[REG_GPPU],         exp->gppu },
+    };
+
+    for(size_t i = 0; i < sizeof(cmp) / sizeof(cmp[0]); i++){
+
+        if(cmp[i].lu == cmp[i].attendu)
+            continue;
+        if(expander_writeRegister(exp, cmp[i].reg, cmp[i].attendu) < 0){
+            pthread_mutex_unlock(&exp->lock);
+            return Er_Ecriture;
+        }
+        repares++;
+    }
+    exp->stats.nb_repairs += repares;
+    expander_statOp(exp, EXPANDER_STAT_SCRUB, t0);
+    pthread_mutex_unlock(&exp->lock);
+    return repares;
 }
 
 /**
  ** 
- * @brief   configure les pullUp des gpio
+ * @brief   reserve des pins en entree : ils passent en entree tout de suite et
+ *          les fonctions de sortie ne les repasseront plus en sortie
  * 
  * @param   exp pointeur sur variable structuré de l'expander
- * @param   val valeur des pull up en HEXA
+ * @param   mask pins a garder en entree (bit a 1), les autres redeviennent
+ *          des sorties au prochain appel d'une fonction de sortie
+ *
+ * @return  0 si ok, code d'erreur sinon
  *
- * 
  *  **/
-void expander_setPullup(expander_t * exp, uint8_t val){
+int expander_setInputPins(expander_t *exp, uint8_t mask){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
-       // exit(EXIT_FAILURE);
-        return;
+        return Er_Expander_Ecriture;
     }
-    
-        // pull up activé
-    exp->buff[0] = REG_GPPU;
-    exp->buff[1] = val;
 
-    if(write(exp->fd,exp->buff,2) != 2) {
-        printf("ERREUR d'ecriture sur GPPU\r\n");
-        exp->erreur = Er_Ecriture;
-        //exit(EXIT_FAILURE);
-         return; 
+    expander_lock(exp);
+    uint8_t iodir = exp->iodir | mask;
+
+    if(iodir != exp->iodir){
+
+        if(expander_writeRegister(exp, MCP23008_IODIR, iodir) < 0) {
+            pthread_mutex_unlock(&exp->lock);
+            return Er_Ecriture;
+        }
     }
-    usleep(100);
+    exp->inputs = mask;
+    pthread_mutex_unlock(&exp->lock);
+    return 0;
 }
 
 /**
@@ -258,8 +1613,6 @@ uint8_t expander_getAllPinsGPIO(expander_t *exp){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
        // exit(EXIT_FAILURE);
            return 0;
     }
@@ -279,32 +1632,16 @@ uint8_t expander_getAllPinsGPIO(expander_t *exp){
 
     // }
 
-/**
- * Selection du registre GPIO de l'expander
- **/
-    exp->buff[0] = REG_GPIO; 
-    if(write(exp->fd,exp->buff,1) != 1){
-        
-        printf("ERREUR d'écriture du registre GPIO (branché sur i2c?)\n");
-        close(exp->fd);
-        exp->erreur = Er_Ecriture;
-        //exit(EXIT_FAILURE);
-        return 0;
-    }
 /**
  * Lecture du registre GPIO de l'expander
  **/
-    exp->buff[0] = REG_GPIO;
-    if(read(exp->fd,exp->buff,1) != 1) {
-        printf("ERREUR de de lecture sur GPIO\n");
-        close(exp->fd);
-        exp->erreur = Er_Lecture;
+    uint8_t gpio;
+    if(expander_readRegister(exp, REG_GPIO, &gpio) < 0) {
         //exit(EXIT_FAILURE);
         return 0;
     }
-    usleep(100);
     
-    return exp->buff[0];
+    return gpio;
 
 }
 
@@ -324,21 +1661,16 @@ uint8_t expander_getPinGPIO(expander_t *exp, uint8_t pin){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
         //exit(EXIT_FAILURE);
             return 0;
     }
         if(pin > 7 || pin < 0)
     {
-        printf("ERREUR fonction %s : parametre pin selectionne non compris entre 0 et 7\n", __func__);
-        exp->erreur = Er_Expander_Ecriture;
-        //exit(EXIT_FAILURE);
+        expander_recordError(exp, Er_Expander_Ecriture, 0xFF, __func__);
         return 0;
     }
 
     uint8_t ret = expander_getAllPinsGPIO(exp);
-    usleep(100);
 
     return (ret >> pin) & 0x01;
 }
@@ -353,64 +1685,32 @@ uint8_t expander_getPinGPIO(expander_t *exp, uint8_t pin){
  * @param   pin le pin en question (entre 0 et 7)
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_setPinGPIO(expander_t *exp, uint8_t pin){
+int expander_setPinGPIO(expander_t *exp, uint8_t pin){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
        // exit(EXIT_FAILURE);
-        return;
+        return Er_Expander_Ecriture;
     }
     
     if(pin > 7 || pin < 0)
     {
-        printf("ERREUR fonction %s : parametre pin doit etre compris entre 0 et 7\n", __func__);
-        exp->erreur = Er_Expander_Ecriture;
-        //exit(EXIT_FAILURE);
-        return;
+        expander_recordError(exp, Er_Expander_Ecriture, 0xFF, __func__);
+        return Er_Expander_Ecriture;
 
     }
-    uint8_t ancienGPIO = expander_getAllPinsGPIO(exp);
-    uint8_t nouveauGPIO = ancienGPIO | (0x01 << pin);
-
-
-    int cpt = 0;
-    while(expander_getAllPinsGPIO(exp) != nouveauGPIO && cpt < 5){
-    /* Ecriture des gpio de l'expander
-    **/
-        cpt++;
-        exp->buff[0] = MCP23008_IODIR;
-        exp->buff[1] = 0x00;
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur IODIR\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
 
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, exp->olat | (0x01 << pin));
+    pthread_mutex_unlock(&exp->lock);
 
-        exp->buff[0] = REG_OLAT;
-        exp->buff[1] = nouveauGPIO;
-
-    #ifdef DEBUG
-        printf("ecriture sur OLAT de 0x%02x...\n",exp->buff[1]);
-    #endif
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur OLAT\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
-    #ifdef DEBUG
-        printf("mise a 1 de GPIO[%d] %s\n", pin, exp->label[pin]);
-    #endif
-    }
-    usleep(100);
-
+#ifdef DEBUG
+    printf("mise a 1 de GPIO[%d] %s\n", pin, expander_getLabel(exp->addr, pin));
+#endif
+    return ret;
 }
 
 
@@ -423,63 +1723,32 @@ void expander_setPinGPIO(expander_t *exp, uint8_t pin){
  * @param   pin le pin en question (entre 0 et 7)
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_resetPinGPIO(expander_t *exp, uint8_t pin){
+int expander_resetPinGPIO(expander_t *exp, uint8_t pin){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
     
        // exit(EXIT_FAILURE);
-        return;
+        return Er_Expander_Ecriture;
     }
 
     if(pin > 7 || pin < 0)
     {
-        printf("ERREUR fonction %s : parametre pin doit etre compris entre 0 et 7\n", __func__);
-        exp->erreur = Er_Expander_Ecriture;
-        //exit(EXIT_FAILURE);
-        return;
+        expander_recordError(exp, Er_Expander_Ecriture, 0xFF, __func__);
+        return Er_Expander_Ecriture;
     }
 
-    uint8_t ancienGPIO = expander_getAllPinsGPIO(exp);
-    uint8_t nouveauGPIO = ancienGPIO & ~(0x01 << pin);
-
-    int cpt = 0;
-    while(expander_getAllPinsGPIO(exp) != nouveauGPIO && cpt < 5){
-
-    /* Ecriture des gpio de l'expander
-    **/         
-        cpt++;
-        exp->buff[0] = MCP23008_IODIR;
-        exp->buff[1] = 0x00;
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur IODIR\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;    
-        }
-
-        exp->buff[0] = REG_OLAT;
-
-        exp->buff[1] = nouveauGPIO;
-
-    #ifdef DEBUG
-        printf("__Ecriture sur OLAT de 0x%02x...\n",exp->buff[1]);
-    #endif
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur OLAT\r\n");
-            exp->erreur = Er_Ecriture;
-           // exit(EXIT_FAILURE);
-            return;
-        }
-        #ifdef DEBUG
-        printf("mise a 0 de GPIO[%d] %s\n", pin , exp->label[pin]);
-    #endif
-    }
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, exp->olat & ~(0x01 << pin));
+    pthread_mutex_unlock(&exp->lock);
 
+#ifdef DEBUG
+    printf("mise a 0 de GPIO[%d] %s\n", pin , expander_getLabel(exp->addr, pin));
+#endif
+    return ret;
 }
 
 
@@ -492,31 +1761,31 @@ void expander_resetPinGPIO(expander_t *exp, uint8_t pin){
  * @param   pin le pin en question (entre 0 et 7)
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_togglePinGPIO(expander_t* exp, uint8_t pin){
+int expander_togglePinGPIO(expander_t* exp, uint8_t pin){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
         //exit(EXIT_FAILURE);
-        return;
+        return Er_Expander_Ecriture;
     }
 
     if(pin > 7 || pin < 0)
     {
-        printf("ERREUR fonction %s : parametre pin doit etre compris entre 0 et 7\n", __func__);
-        exp->erreur = Er_Expander_Ecriture;
-        //exit(EXIT_FAILURE);
-        return;
+        expander_recordError(exp, Er_Expander_Ecriture, 0xFF, __func__);
+        return Er_Expander_Ecriture;
     }
 
-    if(expander_getPinGPIO(exp, pin)){
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, exp->olat ^ (0x01 << pin));
+    pthread_mutex_unlock(&exp->lock);
 
-        expander_resetPinGPIO(exp,pin);
-    }
-    else{
-        expander_setPinGPIO(exp,pin);
-    }
+#ifdef DEBUG
+    printf("inversion de GPIO[%d] %s\n", pin, expander_getLabel(exp->addr, pin));
+#endif
+    return ret;
 }
 
 /**
@@ -526,51 +1795,25 @@ void expander_togglePinGPIO(expander_t* exp, uint8_t pin){
  * @param   exp pointeur sur variable structuré de l'expander
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_setAllPinsGPIO(expander_t *exp){
+int expander_setAllPinsGPIO(expander_t *exp){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
         //exit(EXIT_FAILURE);
-            return;
+            return Er_Expander_Ecriture;
     }
 
-    int cpt = 0;
-    while(expander_getAllPinsGPIO(exp) != 0xFF && cpt < 5){
-    /* Ecriture des gpio de l'expander
-    **/
-
-        cpt++;
-        exp->buff[0] = MCP23008_IODIR;
-        exp->buff[1] = 0x00;
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur IODIR\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
-
-        exp->buff[0] = REG_OLAT;
-        exp->buff[1] = 0xFF;
-    #ifdef DEBUG
-        printf("ecriture sur OLAT de 0x%02x...\n",exp->buff[1]);
-    #endif
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur OLAT\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
-    #ifdef DEBUG
-        printf("mise a 1 de tous les GPIO\n");
-    #endif
-    }
-    usleep(100);
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, 0xFF);
+    pthread_mutex_unlock(&exp->lock);
 
+#ifdef DEBUG
+    printf("mise a 1 de tous les GPIO\n");
+#endif
+    return ret;
 }
 
 
@@ -582,48 +1825,25 @@ void expander_setAllPinsGPIO(expander_t *exp){
  * @param   exp pointeur sur variable structuré de l'expander
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_resetAllPinsGPIO(expander_t *exp){
+int expander_resetAllPinsGPIO(expander_t *exp){
 
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
         //exit(EXIT_FAILURE);
-        return;    
-    }
-    int cpt = 0;
-    while(expander_getAllPinsGPIO(exp) != 0x00 && cpt < 5){
-    /* Ecriture des gpio de l'expander
-    **/
-        cpt++;
-        exp->buff[0] = MCP23008_IODIR;
-        exp->buff[1] = 0x00;
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur IODIR\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
-
-        exp->buff[0] = REG_OLAT;
-    #ifdef DEBUG
-        printf("ecriture sur OLAT de 0x%02x...\n",exp->buff[1]);
-    #endif
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur OLAT\r\n");
-            exp->erreur = Er_Ecriture;
-           // exit(EXIT_FAILURE);
-            return;    
-        }
-    #ifdef DEBUG
-        printf("mise a 0 de tous les GPIO\n");
-    #endif
+        return Er_Expander_Ecriture;    
     }
-    usleep(100);
-
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, 0x00);
+    pthread_mutex_unlock(&exp->lock);
+
+#ifdef DEBUG
+    printf("mise a 0 de tous les GPIO\n");
+#endif
+    return ret;
 }
 
 
@@ -636,58 +1856,32 @@ void expander_resetAllPinsGPIO(expander_t *exp){
  * @param   pin le pin en question (entre 0 et 7)
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_setOnlyPinResetOthersGPIO(expander_t* exp, uint8_t pin){
+int expander_setOnlyPinResetOthersGPIO(expander_t* exp, uint8_t pin){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
         //exit(EXIT_FAILURE);
-        return;
+        return Er_Expander_Ecriture;
     }
     
     if(pin > 7 || pin < 0)
     {
-        printf("ERREUR fonction %s : parametre pin doit etre compris entre 0 et 7\n", __func__);
-        exp->erreur = Er_Expander_Ecriture;
-        //exit(EXIT_FAILURE);
-        return;
+        expander_recordError(exp, Er_Expander_Ecriture, 0xFF, __func__);
+        return Er_Expander_Ecriture;
     
 
     }
-    int cpt = 0;
-    while(expander_getAllPinsGPIO(exp) != (0x01 << pin) && cpt < 5){
-        
-        cpt++;
-        exp->buff[0] = MCP23008_IODIR;
-        exp->buff[1] = 0x00;
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            
-            printf("ERREUR d'ecriture sur IODIR\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
-        exp->buff[0] = REG_OLAT;
-        exp->buff[1] = 0x01 << pin;
-        #ifdef DEBUG
-        printf("ecriture sur OLAT de 0x%02x...\n",exp->buff[1]);
-        #endif
-        if(write(exp->fd,exp->buff,2) != 2) {
-            
-            printf("ERREUR d'ecriture sur OLAT\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
-        #ifdef DEBUG
-        printf("mise a 1 du seul GPIO[%d] %s\n", pin, exp->label[pin]);
-        #endif
-    }
-    usleep(100);
-
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, 0x01 << pin);
+    pthread_mutex_unlock(&exp->lock);
+
+#ifdef DEBUG
+    printf("mise a 1 du seul GPIO[%d] %s\n", pin, expander_getLabel(exp->addr, pin));
+#endif
+    return ret;
 }
 
 
@@ -700,55 +1894,30 @@ void expander_setOnlyPinResetOthersGPIO(expander_t* exp, uint8_t pin){
  * @param   pin le pin en question (entre 0 et 7)
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_resetOnlyPinSetOthersGPIO(expander_t* exp, uint8_t pin){
+int expander_resetOnlyPinSetOthersGPIO(expander_t* exp, uint8_t pin){
     
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
         //exit(EXIT_FAILURE);
-        return;    
+        return Er_Expander_Ecriture;    
     }
 
     if(pin > 7 || pin < 0)
     {
-        printf("ERREUR fonction %s : parametre pin doit etre compris entre 0 et 7\n", __func__);
-        exp->erreur = Er_Expander_Ecriture;
-       // exit(EXIT_FAILURE);
-        return;
-    }
-    int cpt = 0;
-    while(expander_getAllPinsGPIO(exp) != (0x01 << pin) && cpt < 5){
-        
-        cpt++;
-        exp->buff[0] = MCP23008_IODIR;
-        exp->buff[1] = 0x00;
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur IODIR\r\n");
-            exp->erreur = Er_Ecriture;
-           // exit(EXIT_FAILURE);
-            return;
-        }
-        
-        exp->buff[0] = REG_OLAT;
-        exp->buff[1] = ~(0x01 << pin);
-    #ifdef DEBUG
-        printf("ecriture sur OLAT de 0x%02x...\n",exp->buff[1]);
-    #endif
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur OLAT\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
-        #ifdef DEBUG
-        printf("mise a 1 du seul GPIO[%d]\n", pin);
-    #endif
+        expander_recordError(exp, Er_Expander_Ecriture, 0xFF, __func__);
+        return Er_Expander_Ecriture;
     }
-    usleep(100);
-    
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, (uint8_t)~(0x01 << pin));
+    pthread_mutex_unlock(&exp->lock);
+
+#ifdef DEBUG
+    printf("mise a 0 du seul GPIO[%d] %s\n", pin, expander_getLabel(exp->addr, pin));
+#endif
+    return ret;
 }
 
 /**
@@ -759,48 +1928,80 @@ void expander_resetOnlyPinSetOthersGPIO(expander_t* exp, uint8_t pin){
  * @param   config la config sur un octet
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_setAndResetSomePinsGPIO(expander_t* exp, uint8_t config){
+int expander_setAndResetSomePinsGPIO(expander_t* exp, uint8_t config){
 
         
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
         //exit(EXIT_FAILURE);
-        return;    
+        return Er_Expander_Ecriture;    
     }
-        exp->buff[0] = MCP23008_IODIR;
-        exp->buff[1] = 0;
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, config);
+    pthread_mutex_unlock(&exp->lock);
+
+#ifdef DEBUG
+    printf("mise a %02x du GPIO\n", config);
+#endif
+    return ret;
+}
 
-    if(write(exp->fd,exp->buff,2) != 2) {
-        printf("ERREUR d'ecriture sur IODIR\r\n");
-        exp->erreur = Er_Ecriture;
-       // exit(EXIT_FAILURE);
-        return;
-    }
-    int cpt = 0;
-    while(expander_getAllPinsGPIO(exp) != config && cpt < 5){
-
-        cpt++;
-        exp->buff[0] = REG_OLAT;
-        exp->buff[1] = config;
-    #ifdef DEBUG
-        printf("ecriture sur OLAT de 0x%02x...\n",exp->buff[1]);
-    #endif
-
-        if(write(exp->fd,exp->buff,2) != 2) {
-            printf("ERREUR d'ecriture sur OLAT\r\n");
-            exp->erreur = Er_Ecriture;
-            //exit(EXIT_FAILURE);
-            return;
-        }
-        #ifdef DEBUG
-        printf("mise a %02x du GPIO\n", config);
-    #endif
-    }
-    usleep(100);
+/**
+ * 
+ * @brief    met a 1 les pins de set et a 0 ceux de clear, sans toucher aux
+ *           autres. Les masques sont pris tels quels (pas de numero de pin a
+ *           verifier) : c'est le chemin de expander_board.hpp
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   set pins a mettre a 1
+ * @param   clear pins a mettre a 0 (set l'emporte)
+ * 
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *
+ *  **/
+int expander_updatePinsGPIO(expander_t* exp, uint8_t set, uint8_t clear){
+
+    if(exp == NULL)
+        return Er_Expander_Ecriture;
+
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, (exp->olat & ~clear) | set);
+    pthread_mutex_unlock(&exp->lock);
+
+#ifdef DEBUG
+    printf("mise a 1 de 0x%02x, mise a 0 de 0x%02x du GPIO\n", set, clear);
+#endif
+    return ret;
+}
+
+/**
+ * 
+ * @brief    inverse les pins de mask
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   mask pins a inverser
+ * 
+ * 
+ * @return  0 si ok, code d'erreur sinon
+ *
+ *  **/
+int expander_togglePinsGPIO(expander_t* exp, uint8_t mask){
 
+    if(exp == NULL)
+        return Er_Expander_Ecriture;
+
+    expander_lock(exp);
+    int ret = expander_writeOLAT(exp, exp->olat ^ mask);
+    pthread_mutex_unlock(&exp->lock);
+
+#ifdef DEBUG
+    printf("inversion de 0x%02x du GPIO\n", mask);
+#endif
+    return ret;
 }
 
 /**
@@ -810,15 +2011,15 @@ void expander_setAndResetSomePinsGPIO(expander_t* exp, uint8_t config){
  * @param   exp pointeur sur variable structuré de l'expander
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_printGPIO(expander_t *exp){
+int expander_printGPIO(expander_t *exp){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
        // exit(EXIT_FAILURE);
-            return;
+            return Er_Expander_Ecriture;
     }
 
 /**
@@ -838,25 +2039,18 @@ void expander_printGPIO(expander_t *exp){
 /**
  * Lecture du registre GPIO de l'expander
  **/
-    exp->buff[0] = REG_GPIO;
-    if(write(exp->fd,exp->buff,1) != 1) {
-        printf("ERREUR de selection du registre GPIO pour lecture\n");
-        close(exp->fd);
-        exp->erreur = Er_Lecture;
-       // exit(EXIT_FAILURE);
-        return;
-    }
-
-    exp->buff[0] = REG_GPIO;
-    if(read(exp->fd,exp->buff,1) != 1) {
-        printf("ERREUR de de lecture sur GPIO\n");
-        close(exp->fd);
-        exp->erreur = Er_Lecture;
+    // affichage : ne passe pas devant les autres transferts du bus
+    int prio = expander_thread_prio;
+    uint8_t gpio;
+
+    expander_thread_prio = EXPANDER_PRIO_BACKGROUND;
+    int ret = expander_readRegister(exp, REG_GPIO, &gpio);
+    expander_thread_prio = prio;
+    if(ret < 0) {
        // exit(EXIT_FAILURE);
-        return;
+        return Er_Lecture;
     }
 
-    usleep(1);
 /**
  * Affichage des ports GPIO de l'expander
  **/
@@ -866,12 +2060,11 @@ void expander_printGPIO(expander_t *exp){
     for (int i = 0; i < 8; i++)
     {
         
-        printf("%s GPIO[%d] : %d\r\n",exp->label[i], i, (exp->buff[0] >> i ) & 0x01);
+        printf("%s GPIO[%d] : %d\r\n",expander_getLabel(exp->addr, i), i, (gpio >> i ) & 0x01);
     }
     printf("_______________________________\n");
     putchar('\n');
-    usleep(100);
-
+    return 0;
 }
 
 /**
@@ -881,29 +2074,64 @@ void expander_printGPIO(expander_t *exp){
  * @param   val valeur des polarité, Si un bit est est à 1, le bit du registre GPIO correspondant reflétera la valeur inversée sur la broche.
  * 
  * 
+ * @return  0 si ok, code d'erreur sinon
+ *
  *  **/
-void expander_polGPIO(expander_t *exp, uint8_t val){
+int expander_polGPIO(expander_t *exp, uint8_t val){
 
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
-
         //exit(EXIT_FAILURE);
-        return;
+        return Er_Expander_Ecriture;
     }
 
+    expander_lock(exp);
+    int ret = 0;
+    if(!exp->warm || val != exp->ipol)
+        ret = expander_writeRegister(exp, MCP23008_IPOL, val);
+    pthread_mutex_unlock(&exp->lock);
+    return ret;
+}
 
-    exp->buff[0] = MCP23008_IPOL;
-    exp->buff[1] = val;
-    if(write(exp->fd,exp->buff,2) != 2){
-        
-        printf("ERREUR d'écriture du registre IPOL (branché sur i2c?)\n");
-        close(exp->fd);
-        exp->erreur = Er_Ecriture;
-        //exit(EXIT_FAILURE);
+/**
+ * 
+ * @brief   prend le verrou (recursif) de l'expander. S'il est tenu par un autre
+ *          thread, la priorité de l'appelant est pretée au detenteur le temps de
+ *          l'attente : un transfert de fond en file sur le bus ne retarde pas
+ *          une ecriture critique sur le meme expander
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * 
+ *  **/
+void expander_lock(expander_t *exp)
+{
+    if(pthread_mutex_trylock(&exp->lock) == 0)
         return;
-    }
 
+    expander_bus_t *bus = exp->bus;
+    int prio = expander_effPrio(exp);
+
+    expander_bus_inherit(bus, &exp->inherit, prio, 1);
+    pthread_mutex_lock(&exp->lock);
+    expander_bus_inherit(bus, &exp->inherit, prio, -1);
+}
+
+/**
+ * 
+ * @brief   detache l'expander de son bus et detruit son verrou, sans liberer
+ *          sa memoire (expander initialisé par expander_initInPlace)
+ * 
+ * @param   exp pointeur sur variable structuré de l'expander
+ * 
+ * 
+ *  **/
+void expander_deinit(expander_t *exp)
+{
+    if(exp == NULL || exp == 0)
+        return;
+
+    expander_closeI2C(exp);
+    pthread_mutex_destroy(&exp->lock);
 }
 
 /**
@@ -918,10 +2146,9 @@ void expander_closeAndFree(expander_t *exp)
 {
     if(exp == NULL || exp == 0)
     {
-        printf("ERREUR fonction %s : parametre exp NULL (utiliser: expander_init())\n", __func__);
     
         return;
     }
-    expander_closeI2C(exp);
+    expander_deinit(exp);
     free(exp);
 }
@@ -24,10 +24,17 @@
 #include <linux/ioctl.h>
 #include <linux/types.h>
 #include <linux/i2c-dev.h>
+#include <linux/i2c.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
 #include <wiringPi.h>
 #include <wiringPiI2C.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // pour les printf colorés
 #define RESET	"\033[0m"
 #define GREEN	"\033[32m"
@@ -35,6 +42,23 @@
 
 
 
+// codes d'erreur
+#define Er_Ecriture -1
+#define Er_Lecture -2
+#define Er_Ouverture -3
+#define Er_Fermeture -4
+#define Er_I2C  -5
+#define Er_Plein -6
+#define Er_Expander_Ecriture -10
+
+#define EXPANDER_NB_ERR     11      // compteurs d'erreurs, indexés par -code (nb_err[-Er_Lecture])
+#define EXPANDER_ERR_RING   16      // erreurs gardées en memoire par expander
+#define EXPANDER_STAT_NB_BUCKETS 24 // histogrammes : < 1us, puis [2^(i-1), 2^i[ us
+#define EXPANDER_BUS_CLOCK_HZ   100000  // horloge du bus par defaut, pour estimer le temps sur le fil
+#define EXPANDER_CACHE_LINE     64      // alignement de expander_t
+#define EXPANDER_SCRUB_PERIOD_MS 1000   // periode du controle de fond (EXPANDER_VERIFY_SCRUB)
+#define EXPANDER_SCHED_BUDGET_US 2000   // temps de bus (estimé) qu'un transfert en attente laisse passer devant lui, au plus
+
 #define I2C_DEVICE          "/dev/i2c-1"
 #define VERSION_EXPANDER_I2C "1.0"
 
@@ -78,52 +102,351 @@
 #define REG_GPIO 0x09   //!< Port register
 #define REG_OLAT 0x0A   //!< Output latch register
 
+#define EXPANDER_NB_REG 11      //!< registres 0x00 (IODIR) a 0x0A (OLAT)
+
+// bits du registre IOCON
+#define IOCON_SEQOP     0x20    //!< 1 : auto-increment de l'adresse desactive
+#define IOCON_DISSLW    0x10    //!< slew rate SDA desactive
+#define IOCON_HAEN      0x08    //!< adresse materielle (version SPI uniquement)
+#define IOCON_ODR       0x04    //!< sortie INT en drain ouvert
+#define IOCON_INTPOL    0x02    //!< polarité de INT (1 : actif haut)
+
+struct expander_bus;
+
 /*
- LES LABELS SONT A CHANGER DANS LA FONCTION expanderlabelize()
+ Couche de transport : toutes les entrees/sorties de la librairie passent par
+ cette table de fonctions. expander_transport_i2cdev pilote le vrai bus via
+ /dev/i2c-N, expander_transport_sim (expander_sim.h) un MCP23008 simule.
+ Chaque message porte l'adresse de son expander.
 */
-typedef struct expander
+typedef struct expander_transport
 {
-    /* data */
-    int fd;                     // descripeur du fichier /dev/i2c-dev
-    uint8_t buff[4];            // buffer contenant la derniere valeur ecrite ou lue
-    char label[8][MAX_STRING];  // label des port GPIO pour l'affichage dans console
+    const char *name;
+    int (*open)(struct expander_bus *bus);      // 0 si ok, <0 sinon
+    int (*close)(struct expander_bus *bus);     // 0 si ok, <0 sinon
+    int (*xfer)(struct expander_bus *bus, struct i2c_msg *msgs, int nmsgs); // 0 si tous les messages sont passes, <0 sinon
+
+}expander_transport_t;
+
+extern const expander_transport_t expander_transport_i2cdev;
+
+/*
+ Maniere d'acceder a l'adaptateur (transport i2c-dev), choisie a l'ouverture
+ d'apres I2C_FUNCS : la plus rapide que l'adaptateur sait faire
+*/
+typedef enum expander_method
+{
+    EXPANDER_METHOD_RDWR,       // I2C_RDWR : tous les messages en un ioctl, repeated start
+    EXPANDER_METHOD_SMBUS,      // I2C_SMBUS byte-data / i2c-block : un ioctl par registre ou rafale
+    EXPANDER_METHOD_RW,         // write()/read() avec I2C_SLAVE : un appel par message
+
+}expander_method_t;
+
+/*
+ Priorité d'un transfert : quand plusieurs attendent le bus, le plus prioritaire
+ passe d'abord. Un transfert qui a vu passer EXPANDER_SCHED_BUDGET_US de temps
+ de bus devant lui passe en tete, quelle que soit sa priorité
+*/
+typedef enum expander_prio
+{
+    EXPANDER_PRIO_BACKGROUND,   // diagnostics, affichage (expander_printGPIO)
+    EXPANDER_PRIO_NORMAL,       // par defaut
+    EXPANDER_PRIO_HIGH,
+    EXPANDER_PRIO_CRITICAL,     // lignes de securité
+    EXPANDER_NB_PRIO,
+
+}expander_prio_t;
+
+struct expander_waiter;
+
+/*
+ Heritage de priorité : un thread bloqué sur le verrou d'un expander prete sa
+ priorité au transfert que le detenteur du verrou a en file sur le bus (ex:
+ expander_printGPIO en fond pendant qu'une ecriture critique attend le meme
+ expander). Protégé par sched_lock du bus.
+*/
+typedef struct expander_inherit
+{
+    struct expander_waiter *queued;         // transfert du detenteur en attente du bus, NULL sinon
+    uint16_t nb_wait[EXPANDER_NB_PRIO];     // threads bloqués sur le verrou, par priorité
+
+}expander_inherit_t;
+
+/*
+ Un bus par adaptateur (ou par contexte de transport), partagé par tous les
+ expanders qui y sont attachés : un seul descripteur, compteur de references,
+ et un verrou qui serialise les transferts, tenu le temps du seul transfert.
+*/
+typedef struct expander_bus
+{
+    int fd;                     // descripteur de /dev/i2c-N (transport i2c-dev)
+    char path[32];              // chemin de l'adaptateur
+    const expander_transport_t *tr; // transport utilise sur ce bus
+    void *tr_ctx;               // contexte propre au transport (ex: expander_sim_t*)
+    int refcount;               // expanders attachés + references ouvertes
+    pthread_mutex_t lock;       // serialise les transferts sur le bus
+
+    uint64_t nb_xfer;           // transferts passés sur le bus (sous lock)
+    uint64_t nb_bytes;          // octets de donnees, adresses non comprises
+    uint64_t busy_ns;           // temps passé dans le transport, verrou tenu
+    struct expander_trace *trace; // trace des transferts (expander_trace.h), NULL si coupée
+    uint32_t clock_hz;          // horloge du bus (estimation du temps sur le fil)
+    pthread_mutex_t sched_lock; // ordonnanceur : file d'attente du bus
+    int sched_busy;             // un transfert a le bus
+    struct expander_waiter *waiters;    // transferts en attente, par ordre d'arrivee
+    uint64_t prio_xfer[EXPANDER_NB_PRIO];       // transferts par priorité
+    uint64_t prio_wire_ns[EXPANDER_NB_PRIO];    // temps sur le fil estimé
+    uint64_t prio_busy_ns[EXPANDER_NB_PRIO];    // temps passé dans le transport
+    uint64_t prio_wait_ns[EXPANDER_NB_PRIO];    // attente du bus
+    uint64_t prio_max_wait_ns[EXPANDER_NB_PRIO];
+    unsigned long funcs;        // I2C_FUNCS de l'adaptateur
+    expander_method_t method;   // acces utilisé (transport i2c-dev)
+    int slave;                  // adresse selectionnée par I2C_SLAVE, -1 si aucune
+    pthread_mutex_t scrub_lock; // controle de fond : liste, periode, thread
+    pthread_cond_t scrub_cond;  // reveille le thread (arret, nouvelle periode)
+    pthread_cond_t scrub_done;  // un expander de la liste n'est plus en controle
+    pthread_t scrub_thread;     // demarré au premier expander en EXPANDER_VERIFY_SCRUB
+    int scrub_started;
+    int scrub_stop;
+    uint32_t scrub_period_ms;
+    struct expander *scrub_list;    // expanders en EXPANDER_VERIFY_SCRUB
+    struct expander_bus *next;  // liste des bus ouverts
+
+}expander_bus_t;
+
+/*
+ Politique de temporisation : par defaut aucune attente. gap_us impose un ecart
+ minimum entre deux transferts vers l'expander, settle_us une attente apres une
+ ecriture qui change l'un des pins de settle_mask (ex: relais, ligne lente).
+*/
+typedef struct expander_timing
+{
+    uint32_t gap_us;            // ecart minimum entre deux transferts (0 : aucun)
+    uint32_t settle_us;         // attente apres changement d'un pin de settle_mask
+    uint8_t settle_mask;        // pins concernés par settle_us
+
+}expander_timing_t;
+
+/*
+ Verification des ecritures de sortie : aucune (une seule ecriture par appel),
+ relecture de OLAT apres chaque ecriture, ou controle periodique : un thread par
+ bus appelle expander_scrub() toutes les EXPANDER_SCRUB_PERIOD_MS
+ (expander_bus_setScrubPeriod), qui compare les registres a la copie locale et
+ les repare.
+*/
+typedef enum expander_verify
+{
+    EXPANDER_VERIFY_NONE,       // ecriture seule (par defaut)
+    EXPANDER_VERIFY_OLAT,       // relecture de OLAT, une reecriture si difference
+    EXPANDER_VERIFY_SCRUB,      // rien sur le chemin critique, expander_scrub() par le thread du bus
+
+}expander_verify_t;
+
+/*
+ etat complet du MCP23008 (registres 0x00 a 0x0A), lu et restauré en rafale
+*/
+typedef struct expander_state
+{
+    uint8_t reg[EXPANDER_NB_REG];
+
+}expander_state_t;
+
+/*
+ Mesures d'un expander. Les histogrammes de latence sont en puissances de 2 de
+ microsecondes : hist[op][0] compte les appels < 1us, hist[op][i] ceux entre
+ 2^(i-1) et 2^i us (le dernier seau prend tout le reste).
+*/
+typedef enum expander_stat_op
+{
+    EXPANDER_STAT_READ,         // transfert contenant une lecture (attente du bus comprise)
+    EXPANDER_STAT_WRITE,        // transfert d'ecriture seule
+    EXPANDER_STAT_OUTPUT,       // fonction de sortie complete (IODIR, OLAT, verification, settle)
+    EXPANDER_STAT_SCRUB,        // expander_scrub
+    EXPANDER_STAT_NB_OP,
+
+}expander_stat_op_t;
+
+typedef struct expander_stats
+{
+    uint64_t nb_xfer;           // transferts (= appels systeme sur le vrai bus)
+    uint64_t nb_msgs;           // messages i2c
+    uint64_t nb_bytes;          // octets de donnees
+    uint64_t nb_retries;        // reecritures apres une verification ratée
+    uint64_t nb_verify_mismatch;// relectures de OLAT differentes de la valeur ecrite
+    uint64_t nb_repairs;        // registres reparés par expander_scrub
+    uint64_t nb_errors;         // erreurs notées (toutes categories)
+
+    uint64_t nb_op[EXPANDER_STAT_NB_OP];
+    uint64_t sum_ns[EXPANDER_STAT_NB_OP];
+    uint64_t max_ns[EXPANDER_STAT_NB_OP];
+    uint32_t hist[EXPANDER_STAT_NB_OP][EXPANDER_STAT_NB_BUCKETS];
+
+}expander_stats_t;
+
+typedef struct expander_bus_stats
+{
+    uint64_t nb_xfer;
+    uint64_t nb_bytes;
+    uint64_t busy_ns;
+
+    uint64_t prio_xfer[EXPANDER_NB_PRIO];
+    uint64_t prio_wire_ns[EXPANDER_NB_PRIO];    // estimé d'apres les octets et clock_hz
+    uint64_t prio_busy_ns[EXPANDER_NB_PRIO];
+    uint64_t prio_wait_ns[EXPANDER_NB_PRIO];
+    uint64_t prio_max_wait_ns[EXPANDER_NB_PRIO];
+
+}expander_bus_stats_t;
+
+/*
+ erreur notée dans l'anneau de l'expander, vidé par expander_popError()
+*/
+typedef struct expander_err
+{
+    uint64_t timestamp_ns;      // date de l'erreur (CLOCK_MONOTONIC)
+    int8_t code;                // Er_...
+    uint8_t reg;                // registre concerné, 0xFF si aucun
+    const char *func;           // fonction de la librairie ou elle s'est produite
+
+}expander_err_t;
+
+/*
+ Poignée d'un expander : la copie locale et la configuration sont en tete, le
+ verrou, les mesures et le suivi des erreurs viennent apres.
+ La structure est alignée sur 64 octets et sa taille en est un multiple : dans
+ un tableau d'expander_t deux expanders ne partagent jamais une ligne de cache.
+ Les labels des pins sont dans une table a part (expander_setLabels).
+*/
+typedef struct __attribute__((aligned(EXPANDER_CACHE_LINE))) expander
+{
+    expander_bus_t *bus;        // bus (partagé) sur lequel se trouve l'expander
+    uint64_t last_xfer_ns;      // fin du dernier transfert (CLOCK_MONOTONIC)
+    expander_timing_t timing;   // attentes a respecter (aucune par defaut)
+    expander_verify_t verify;   // verification des ecritures de sortie
     uint8_t addr;
-    int8_t erreur;              // TODO :mettre en place un systeme d'erreur pour le debug
+    int8_t erreur;              // dernier code d'erreur (0 apres expander_clearErrors)
+
+    /* copie locale des registres (lue en un transfert dans expander_init) */
+    uint8_t iodir;              // copie de IODIR
+    uint8_t ipol;               // copie de IPOL
+    uint8_t gppu;               // copie de GPPU
+    uint8_t olat;               // copie de OLAT, sert de base aux set/reset/toggle
+    uint8_t iocon;              // copie de IOCON (SEQOP a 0 pour les acces en rafale)
+    uint8_t inputs;             // pins reservés en entree, jamais repassés en sortie
+    uint8_t prio;               // priorité de ses transferts sur le bus (expander_prio_t)
+    uint8_t warm;               // expander_attach : n'ecrire que ce qui change sur le MCP
+
+    pthread_mutex_t lock;       // verrou (recursif) de l'expander : copie locale et
+                                // sequences lecture-modification-ecriture
+
+    uint32_t nb_err[EXPANDER_NB_ERR];           // erreurs par categorie, indexées par -code
+    uint32_t nb_err_lost;                       // erreurs ecrasées dans l'anneau avant d'etre lues
+    expander_err_t err_ring[EXPANDER_ERR_RING]; // dernieres erreurs
+    uint8_t err_head;                           // plus ancienne erreur de l'anneau
+    uint8_t err_count;                          // erreurs dans l'anneau
+
+    expander_stats_t stats;     // mesures (expander_getStats)
+    char path[32];              // adaptateur rouvert par expander_openI2C
+    struct expander *scrub_next;// liste de controle de fond du bus
+    int scrub_pin;              // copies de la liste en cours de controle (scrub_lock)
+    expander_inherit_t inherit; // priorités pretées par les threads bloqués sur lock
 
 }expander_t;
 
+expander_bus_t* expander_bus_open(const char *path);
+expander_bus_t* expander_bus_openTransport(const expander_transport_t*, void*);
+void expander_bus_ref(expander_bus_t*);
+void expander_bus_close(expander_bus_t*);
+int expander_bus_transfer(expander_bus_t*, struct i2c_msg*, int);
+int expander_bus_transferPrio(expander_bus_t*, struct i2c_msg*, int, expander_prio_t);
+int expander_bus_transferInherit(expander_bus_t*, struct i2c_msg*, int, expander_prio_t, expander_inherit_t*);
+void expander_bus_inherit(expander_bus_t*, expander_inherit_t*, int prio, int delta);
+int expander_bus_setClock(expander_bus_t*, uint32_t hz);
+uint64_t expander_bus_wireTime(const expander_bus_t*, const struct i2c_msg*, int);
+int expander_bus_getStats(expander_bus_t*, expander_bus_stats_t*);
+void expander_bus_resetStats(expander_bus_t*);
+int expander_bus_trace(expander_bus_t*, const char *file, unsigned int depth);
+int expander_bus_setMethod(expander_bus_t*, expander_method_t);
+const char* expander_bus_methodName(const expander_bus_t*);
+int expander_bus_setScrubPeriod(expander_bus_t*, uint32_t ms);
+void expander_bus_scrubWatch(expander_bus_t*, struct expander*, int on);
+
 expander_t* expander_init(uint8_t);
+expander_t* expander_initPath(const char *path, uint8_t);
+expander_t* expander_initBus(expander_bus_t*, uint8_t);
+int expander_initInPlace(expander_t*, expander_bus_t*, uint8_t);
+expander_t* expander_attach(expander_bus_t*, uint8_t);
+int expander_attachInPlace(expander_t*, expander_bus_t*, uint8_t);
+int expander_discover(expander_bus_t*, uint8_t candidates, expander_t *found[8]);
+void expander_deinit(expander_t*);
+void expander_lock(expander_t*);
+expander_t* expander_initTransport(uint8_t, const expander_transport_t*, void*);
 
 void expander_labelize(expander_t*);
+void expander_setLabels(uint8_t addr, const char *labels[8]);
+const char* expander_getLabel(uint8_t addr, uint8_t pin);
 
-void expander_openI2C(expander_t*);
+int expander_openI2C(expander_t*);
 
-void expander_closeI2C(expander_t*);
+int expander_closeI2C(expander_t*);
 
-void expander_setI2C(expander_t*);
+int expander_setI2C(expander_t*);
 
-void expander_setPullup(expander_t * exp, uint8_t val);
+int expander_setPullup(expander_t * exp, uint8_t val);
+
+int expander_setTiming(expander_t*, const expander_timing_t*);
+
+int expander_setVerify(expander_t*, expander_verify_t);
+int expander_setPriority(expander_t*, expander_prio_t);
+void expander_setThreadPriority(int prio);
+int expander_scrub(expander_t*);
+
+int expander_setInputPins(expander_t*, uint8_t);
+
+int expander_recordError(expander_t*, int code, uint8_t reg, const char *func);
+int expander_popError(expander_t*, expander_err_t*);
+void expander_clearErrors(expander_t*);
+
+int expander_getStats(expander_t*, expander_stats_t*);
+void expander_resetStats(expander_t*);
+uint64_t expander_statPercentile(const expander_stats_t*, expander_stat_op_t, double p);
+
+int expander_transfer(expander_t*, struct i2c_msg*, int);
+int expander_transferMany(expander_t *const *owner, struct i2c_msg*, int);
+int expander_readRegister(expander_t*, uint8_t, uint8_t*);
+int expander_writeRegister(expander_t*, uint8_t, uint8_t);
+void expander_updateShadow(expander_t*, uint8_t, uint8_t);
+
+int expander_readRegisters(expander_t*, uint8_t, uint8_t*, int);
+int expander_writeRegisters(expander_t*, uint8_t, const uint8_t*, int);
+int expander_snapshot(expander_t*, expander_state_t*);
+int expander_restore(expander_t*, const expander_state_t*);
 
 uint8_t expander_getAllPinsGPIO(expander_t*);
 uint8_t expander_getPinGPIO(expander_t*, uint8_t);
 
-void expander_setPinGPIO(expander_t*, uint8_t);
-void expander_resetPinGPIO(expander_t*, uint8_t);
+int expander_setPinGPIO(expander_t*, uint8_t);
+int expander_resetPinGPIO(expander_t*, uint8_t);
 
-void expander_setOnlyPinResetOthersGPIO(expander_t*, uint8_t);
-void expander_resetOnlyPinSetOthersGPIO(expander_t*, uint8_t);
+int expander_setOnlyPinResetOthersGPIO(expander_t*, uint8_t);
+int expander_resetOnlyPinSetOthersGPIO(expander_t*, uint8_t);
 
-void expander_togglePinGPIO(expander_t*, uint8_t);
+int expander_togglePinGPIO(expander_t*, uint8_t);
 
-void expander_setAllPinsGPIO(expander_t*);
-void expander_resetAllPinsGPIO(expander_t*);
+int expander_setAllPinsGPIO(expander_t*);
+int expander_resetAllPinsGPIO(expander_t*);
 
-void expander_setAndResetSomePinsGPIO(expander_t*, uint8_t);
+int expander_setAndResetSomePinsGPIO(expander_t*, uint8_t);
+int expander_updatePinsGPIO(expander_t*, uint8_t set, uint8_t clear);
+int expander_togglePinsGPIO(expander_t*, uint8_t mask);
 
-void expander_polGPIO(expander_t *exp, uint8_t val);
+int expander_polGPIO(expander_t *exp, uint8_t val);
 
-void expander_printGPIO(expander_t*);
+int expander_printGPIO(expander_t*);
 
 void expander_closeAndFree(expander_t*);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,138 @@
+#ifndef _EXPANDER_HPP
+#define _EXPANDER_HPP
+
+/**
+ * @file expander.hpp
+ * @author Hamza RAHAL
+ * @brief  classes C++17 au dessus de la librairie : Bus et Expander liberent
+ *         leurs ressources a la destruction, se deplacent mais ne se copient
+ *         pas, et update() applique un lot de changements de pins sur
+ *         plusieurs expanders avec le minimum de transferts
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+#include "expander_batch.h"
+#include "expander_board.hpp"
+
+namespace mcp {
+
+/*
+ une reference sur un bus (expander_bus_open / expander_bus_close)
+*/
+class Bus
+{
+public:
+    explicit Bus(const char *path = I2C_DEVICE) : bus_(expander_bus_open(path)) {}
+    Bus(const expander_transport_t *tr, void *ctx) : bus_(expander_bus_openTransport(tr, ctx)) {}
+    ~Bus() { expander_bus_close(bus_); }
+
+    Bus(const Bus&) = delete;
+    Bus& operator=(const Bus&) = delete;
+
+    Bus(Bus &&o) noexcept : bus_(std::exchange(o.bus_, nullptr)) {}
+    Bus& operator=(Bus &&o) noexcept
+    {
+        if(this != &o){
+            expander_bus_close(bus_);
+            bus_ = std::exchange(o.bus_, nullptr);
+        }
+        return *this;
+    }
+
+    // faux si l'ouverture a echoué
+    explicit operator bool() const { return bus_ != nullptr; }
+    expander_bus_t* get() const { return bus_; }
+
+private:
+    expander_bus_t *bus_;
+};
+
+/*
+ un expander attaché a un bus (expander_initBus / expander_closeAndFree) ;
+ il garde sa propre reference sur le bus, qui peut etre detruit avant lui
+*/
+class Expander
+{
+public:
+    Expander(const Bus &bus, uint8_t addr)
+        : exp_(bus ? expander_initBus(bus.get(), addr) : nullptr) {}
+    ~Expander() { expander_closeAndFree(exp_); }
+
+    Expander(const Expander&) = delete;
+    Expander& operator=(const Expander&) = delete;
+
+    Expander(Expander &&o) noexcept : exp_(std::exchange(o.exp_, nullptr)) {}
+    Expander& operator=(Expander &&o) noexcept
+    {
+        if(this != &o){
+            expander_closeAndFree(exp_);
+            exp_ = std::exchange(o.exp_, nullptr);
+        }
+        return *this;
+    }
+
+    // faux si l'initialisation a echoué
+    explicit operator bool() const { return exp_ != nullptr; }
+    expander_t* get() const { return exp_; }
+
+    int set(uint8_t pin) const { return expander_setPinGPIO(exp_, pin); }
+    int reset(uint8_t pin) const { return expander_resetPinGPIO(exp_, pin); }
+    int toggle(uint8_t pin) const { return expander_togglePinGPIO(exp_, pin); }
+    int update(uint8_t set, uint8_t clear) const { return expander_updatePinsGPIO(exp_, set, clear); }
+    uint8_t read() const { return expander_getAllPinsGPIO(exp_); }
+
+    // acces par pins typés (expander_board.hpp)
+    template<class C>
+    Port<C> port() const { return Port<C>(exp_); }
+
+private:
+    expander_t *exp_;
+};
+
+/*
+ changement de pins d'un expander : (expander, a mettre a 1, a mettre a 0)
+*/
+struct Update : expander_update_t
+{
+    Update(const Expander &e, uint8_t set, uint8_t clear) : expander_update_t{e.get(), set, clear} {}
+
+    template<class C, uint8_t S, uint8_t R>
+    Update(const Port<C> &p, Mask<C, S>, Mask<C, R>) : expander_update_t{p.exp(), S, R}
+    {
+        static_assert((S & R) == 0, "un pin ne peut pas etre mis a 1 et a 0");
+    }
+};
+
+static_assert(sizeof(Update) == sizeof(expander_update_t), "Update doit rester un expander_update_t");
+
+/*
+ applique une suite de changements (tableau, std::vector, std::array, ou tout
+ conteneur contigu d'Update) : fusion par expander, un transfert par bus
+*/
+inline int update(const expander_update_t *u, std::size_t n)
+{
+    return expander_batch_update(u, (int)n);
+}
+
+inline int update(std::initializer_list<Update> u)
+{
+    return update(u.begin(), u.size());
+}
+
+template<class Range>
+int update(const Range &r)
+{
+    return update(std::data(r), std::size(r));
+}
+
+} // namespace mcp
+
+#endif
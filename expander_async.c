@@ -0,0 +1,358 @@
+/**
+ * @file expander_async.c
+ * @author Hamza RAHAL
+ * @brief  operations asynchrones : file de soumission sans verrou (plusieurs
+ *         producteurs), thread dedié au bus, fins signalées par eventfd
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include <sys/eventfd.h>
+#include "expander_async.h"
+
+
+/**
+ **
+ * @brief   retire la requete suivante de la file de soumission (thread du bus)
+ *
+ * @return  la requete, NULL si la file est vide
+ *
+ **/
+static expander_req_t* sq_pop(expander_async_t *as){
+
+    expander_async_slot_t *slot = &as->sq[as->sq_tail & as->mask];
+
+    if(atomic_load_explicit(&slot->seq, memory_order_acquire) != as->sq_tail + 1)
+        return NULL;
+
+    expander_req_t *req = slot->req;
+    atomic_store_explicit(&slot->seq, as->sq_tail + as->mask + 1, memory_order_release);
+    as->sq_tail++;
+    return req;
+}
+
+/**
+ **
+ * @brief   vrai s'il reste une requete a executer (thread du bus)
+ *
+ **/
+static int sq_pending(expander_async_t *as){
+
+    expander_async_slot_t *slot = &as->sq[as->sq_tail & as->mask];
+    return atomic_load_explicit(&slot->seq, memory_order_acquire) == as->sq_tail + 1;
+}
+
+/**
+ **
+ * @brief   execute une requete avec les fonctions synchrones de la librairie
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+static int async_exec(expander_req_t *req){
+
+    expander_t *exp = req->exp;
+    int ret;
+
+    if(exp == NULL)
+        return Er_Expander_Ecriture;
+
+    switch(req->op){
+
+        case EXPANDER_OP_SET_PIN:       return expander_setPinGPIO(exp, req->arg);
+        case EXPANDER_OP_RESET_PIN:     return expander_resetPinGPIO(exp, req->arg);
+        case EXPANDER_OP_TOGGLE_PIN:    return expander_togglePinGPIO(exp, req->arg);
+        case EXPANDER_OP_SET_PINS:      return expander_setAndResetSomePinsGPIO(exp, req->arg);
+        case EXPANDER_OP_SET_PULLUP:    return expander_setPullup(exp, req->arg);
+        case EXPANDER_OP_SET_POL:       return expander_polGPIO(exp, req->arg);
+        case EXPANDER_OP_READ_GPIO:     return expander_readRegister(exp, REG_GPIO, &req->val);
+        case EXPANDER_OP_READ_REG:      return expander_readRegister(exp, req->reg, &req->val);
+        case EXPANDER_OP_WRITE_REG:     return expander_writeRegister(exp, req->reg, req->arg);
+        case EXPANDER_OP_SCRUB:
+            ret = expander_scrub(exp);
+            if(ret < 0)
+                return ret;
+            req->val = ret;
+            return 0;
+        default:                        return Er_Expander_Ecriture;
+    }
+}
+
+/**
+ **
+ * @brief   thread du bus : execute les requetes dans l'ordre de soumission, dort
+ *          sur kick quand la file est vide. Un seul signal sur fd par rafale
+ *
+ **/
+static void* async_thread(void *arg){
+
+    expander_async_t *as = arg;
+    uint64_t n, pending = 0;
+
+    for(;;){
+
+        expander_req_t *req = sq_pop(as);
+
+        if(req == NULL){
+
+            // signal raté : les fins restent comptées et repartent au tour suivant
+            if(pending && write(as->fd, &pending, sizeof(pending)) == sizeof(pending))
+                pending = 0;
+            if(atomic_load(&as->stop))
+                break;
+
+            // annonce l'attente puis reverifie : une soumission faite entre les
+            // deux voit sleeping a 1 et reveille le thread. La barriere (et celle
+            // de expander_async_submit) empeche de lire la file avant que
+            // sleeping soit visible
+            atomic_store(&as->sleeping, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+            if(!sq_pending(as) && !atomic_load(&as->stop)){
+                // un echec (EINTR) ne fait que reboucler sur la file
+                if(read(as->kick, &n, sizeof(n)) < 0 && errno != EINTR)
+                    fprintf(stderr, "fonction %s: kick read failed: %s\n", __func__, strerror(errno));
+            }
+            atomic_store(&as->sleeping, 0);
+            continue;
+        }
+
+        req->status = async_exec(req);
+        as->nb_done++;
+
+        if(req->cb != NULL){
+            req->cb(req, req->user);
+            atomic_fetch_sub(&as->inflight, 1);
+        }
+        else{
+            size_t head = atomic_load_explicit(&as->cq_head, memory_order_relaxed);
+            as->cq[head & as->mask] = req;
+            atomic_store_explicit(&as->cq_head, head + 1, memory_order_release);
+            pending++;
+        }
+
+        if(pending && !sq_pending(as) && write(as->fd, &pending, sizeof(pending)) == sizeof(pending))
+            pending = 0;
+    }
+    return NULL;
+}
+
+/**
+ **
+ * @brief   cree la file et demarre le thread du bus
+ *
+ * @param   depth nombre maximum d'operations en vol (arrondi a la puissance de 2
+ *          superieure), 0 pour EXPANDER_ASYNC_DEPTH
+ *
+ * @return  la file, NULL si echec
+ *
+ **/
+expander_async_t* expander_async_open(unsigned int depth){
+
+    return expander_async_openFd(depth, -1);
+}
+
+/**
+ **
+ * @brief   comme expander_async_open, mais les fins sont signalées sur un
+ *          eventfd fourni (non bloquant), partagé par plusieurs files
+ *
+ * @param   depth nombre maximum d'operations en vol, 0 pour EXPANDER_ASYNC_DEPTH
+ * @param   fd eventfd des fins (pas fermé par expander_async_close), -1 pour
+ *          en creer un
+ *
+ * @return  la file, NULL si echec
+ *
+ **/
+expander_async_t* expander_async_openFd(unsigned int depth, int fd){
+
+    size_t size = 2;
+
+    if(depth == 0)
+        depth = EXPANDER_ASYNC_DEPTH;
+    while(size < depth)
+        size <<= 1;
+
+    expander_async_t *as = calloc(1, sizeof(expander_async_t));
+    if(as == NULL){
+        printf("ERREUR %s : allocation echouee\n", __func__);
+        return NULL;
+    }
+    as->sq = calloc(size, sizeof(expander_async_slot_t));
+    as->cq = calloc(size, sizeof(expander_req_t*));
+    as->own_fd = (fd < 0);
+    as->fd = as->own_fd ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : fd;
+    as->kick = eventfd(0, EFD_CLOEXEC);
+    if(as->sq == NULL || as->cq == NULL || as->fd < 0 || as->kick < 0)
+        goto erreur;
+
+    as->mask = size - 1;
+    for(size_t i = 0; i < size; i++)
+        atomic_init(&as->sq[i].seq, i);
+
+    if(pthread_create(&as->thread, NULL, async_thread, as) != 0)
+        goto erreur;
+    return as;
+
+erreur:
+    fprintf(stderr, "fonction %s: Unable to create async queue: %s\n", __func__, strerror(errno));
+    if(as->own_fd && as->fd >= 0)
+        close(as->fd);
+    if(as->kick >= 0)
+        close(as->kick);
+    free(as->sq);
+    free(as->cq);
+    free(as);
+    return NULL;
+}
+
+/**
+ **
+ * @brief   termine les operations deja soumises, arrete le thread du bus et
+ *          libere la file (les fins non recuperées par reap sont perdues)
+ *
+ **/
+void expander_async_close(expander_async_t *as){
+
+    uint64_t one = 1;
+
+    if(as == NULL)
+        return;
+
+    atomic_store(&as->stop, 1);
+    if(write(as->kick, &one, sizeof(one)) != sizeof(one))
+        fprintf(stderr, "fonction %s: Unable to wake bus thread: %s\n", __func__, strerror(errno));
+    pthread_join(as->thread, NULL);
+
+    if(as->own_fd)
+        close(as->fd);
+    close(as->kick);
+    free(as->sq);
+    free(as->cq);
+    free(as);
+}
+
+/**
+ **
+ * @brief   prepare une requete (sans rappel)
+ *
+ * @param   req requete a remplir
+ * @param   op operation
+ * @param   exp expander visé
+ * @param   reg registre pour READ_REG/WRITE_REG, ignoré sinon
+ * @param   arg pin, valeur ou masque selon l'operation
+ *
+ **/
+void expander_req_init(expander_req_t *req, expander_op_t op, expander_t *exp, uint8_t reg, uint8_t arg){
+
+    memset(req, 0, sizeof(*req));
+    req->op = op;
+    req->exp = exp;
+    req->reg = reg;
+    req->arg = arg;
+}
+
+/**
+ **
+ * @brief   soumet une requete au thread du bus sans bloquer (utilisable depuis
+ *          plusieurs threads)
+ *
+ * @return  0 si ok, Er_Plein si depth operations sont deja en vol, Er_Ecriture
+ *          si le thread du bus n'a pas pu etre reveillé (la requete est en file
+ *          et part a la prochaine soumission)
+ *
+ **/
+int expander_async_submit(expander_async_t *as, expander_req_t *req){
+
+    if(as == NULL || req == NULL)
+        return Er_Expander_Ecriture;
+
+    if(atomic_fetch_add(&as->inflight, 1) > as->mask){
+        atomic_fetch_sub(&as->inflight, 1);
+        return Er_Plein;
+    }
+
+    size_t pos = atomic_load_explicit(&as->sq_head, memory_order_relaxed);
+    expander_async_slot_t *slot;
+
+    for(;;){
+
+        slot = &as->sq[pos & as->mask];
+        intptr_t dif = (intptr_t)atomic_load_explicit(&slot->seq, memory_order_acquire) - (intptr_t)pos;
+
+        if(dif == 0){
+            if(atomic_compare_exchange_weak_explicit(&as->sq_head, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if(dif < 0){
+            // ne peut arriver tant que inflight est respecté
+            atomic_fetch_sub(&as->inflight, 1);
+            return Er_Plein;
+        }
+        else{
+            pos = atomic_load_explicit(&as->sq_head, memory_order_relaxed);
+        }
+    }
+
+    slot->req = req;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    // publie la requete avant de lire sleeping (voir async_thread)
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_exchange(&as->sleeping, 0)){
+
+        uint64_t one = 1;
+        if(write(as->kick, &one, sizeof(one)) != sizeof(one)){
+            atomic_store(&as->sleeping, 1);
+            return Er_Ecriture;
+        }
+    }
+    return 0;
+}
+
+/**
+ **
+ * @brief   recupere les requetes terminées (sans rappel), sans bloquer. A appeler
+ *          quand as->fd est lisible ; un seul thread doit appeler reap
+ *
+ * @param   as file
+ * @param   reqs recoit les requetes terminées, dans l'ordre de fin
+ * @param   max taille de reqs
+ *
+ * @return  nombre de requetes rendues, Er_Lecture ou Er_Ecriture si l'eventfd
+ *          n'a pas pu etre lu ou rearmé (aucune requete n'est alors rendue)
+ *
+ **/
+int expander_async_reap(expander_async_t *as, expander_req_t **reqs, int max){
+
+    uint64_t n;
+    int i = 0;
+
+    if(as == NULL || reqs == NULL)
+        return 0;
+
+    // non bloquant : EAGAIN si rien n'a été signalé, ce n'est pas une erreur
+    if(read(as->fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+        return Er_Lecture;
+
+    size_t tail = atomic_load_explicit(&as->cq_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&as->cq_head, memory_order_acquire);
+
+    // il en restera : fd reste lisible pour le prochain tour de boucle, rearmé
+    // avant de rendre quoi que ce soit pour ne rien perdre si l'ecriture echoue
+    if(max >= 0 && head - tail > (size_t)max){
+        n = 1;
+        if(write(as->fd, &n, sizeof(n)) != sizeof(n))
+            return Er_Ecriture;
+    }
+
+    while(tail != head && i < max)
+        reqs[i++] = as->cq[tail++ & as->mask];
+
+    atomic_store_explicit(&as->cq_tail, tail, memory_order_release);
+    atomic_fetch_sub(&as->inflight, i);
+    return i;
+}
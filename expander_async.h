@@ -0,0 +1,98 @@
+#ifndef _EXPANDER_ASYNC_H
+#define _EXPANDER_ASYNC_H
+
+/**
+ * @file expander_async.h
+ * @author Hamza RAHAL
+ * @brief  file de soumission sans verrou servie par un thread dedié au bus,
+ *         fin des operations signalée par un eventfd (a mettre dans epoll)
+ *         et/ou une fonction de rappel
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include <stdatomic.h>
+#include "MCP23017.h"
+
+#define EXPANDER_ASYNC_DEPTH    64      // operations en vol par defaut (puissance de 2)
+
+typedef enum expander_op
+{
+    EXPANDER_OP_SET_PIN,        // expander_setPinGPIO(exp, arg)
+    EXPANDER_OP_RESET_PIN,      // expander_resetPinGPIO(exp, arg)
+    EXPANDER_OP_TOGGLE_PIN,     // expander_togglePinGPIO(exp, arg)
+    EXPANDER_OP_SET_PINS,       // expander_setAndResetSomePinsGPIO(exp, arg)
+    EXPANDER_OP_SET_PULLUP,     // expander_setPullup(exp, arg)
+    EXPANDER_OP_SET_POL,        // expander_polGPIO(exp, arg)
+    EXPANDER_OP_READ_GPIO,      // expander_readRegister(exp, REG_GPIO) -> val
+    EXPANDER_OP_READ_REG,       // expander_readRegister(exp, reg) -> val
+    EXPANDER_OP_WRITE_REG,      // expander_writeRegister(exp, reg, arg)
+    EXPANDER_OP_SCRUB,          // expander_scrub(exp) -> val (registres reparés)
+
+}expander_op_t;
+
+struct expander_req;
+typedef void (*expander_req_cb)(struct expander_req*, void *user);
+
+/*
+ operation soumise : la memoire appartient a l'appelant et doit rester valide
+ jusqu'a sa fin (rappel appelé, ou requete rendue par expander_async_reap)
+*/
+typedef struct expander_req
+{
+    expander_op_t op;
+    expander_t *exp;
+    uint8_t reg;                // registre (READ_REG, WRITE_REG)
+    uint8_t arg;                // pin, valeur ou masque selon l'operation
+    uint8_t val;                // valeur lue (READ_GPIO, READ_REG), registres reparés (SCRUB)
+    int status;                 // 0 si ok, code d'erreur sinon
+
+    expander_req_cb cb;         // rappel (dans le thread du bus), NULL : passer par reap
+    void *user;                 // passé au rappel
+
+}expander_req_t;
+
+typedef struct expander_async_slot
+{
+    atomic_size_t seq;
+    expander_req_t *req;
+
+}expander_async_slot_t;
+
+typedef struct expander_async
+{
+    int fd;                     // eventfd des fins d'operation, a surveiller avec poll/epoll
+    int own_fd;                 // fd créé par la file (sinon fourni par expander_async_openFd)
+    int kick;                   // eventfd de reveil du thread du bus
+    size_t mask;                // profondeur - 1
+
+    expander_async_slot_t *sq;  // file de soumission (plusieurs producteurs, sans verrou)
+    atomic_size_t sq_head;      // prochaine place a prendre par un producteur
+    size_t sq_tail;             // prochaine requete a executer (thread du bus)
+
+    expander_req_t **cq;        // file des fins (thread du bus -> appelant de reap)
+    atomic_size_t cq_head;
+    atomic_size_t cq_tail;
+
+    atomic_size_t inflight;     // requetes soumises et pas encore rendues
+    atomic_int sleeping;        // thread du bus en attente sur kick
+    atomic_int stop;
+    pthread_t thread;
+
+    uint64_t nb_done;           // operations terminées
+
+}expander_async_t;
+
+expander_async_t* expander_async_open(unsigned int depth);
+expander_async_t* expander_async_openFd(unsigned int depth, int fd);
+void expander_async_close(expander_async_t*);
+
+void expander_req_init(expander_req_t*, expander_op_t, expander_t*, uint8_t reg, uint8_t arg);
+
+int expander_async_submit(expander_async_t*, expander_req_t*);
+int expander_async_reap(expander_async_t*, expander_req_t **reqs, int max);
+
+#endif
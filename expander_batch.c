@@ -0,0 +1,239 @@
+/**
+ * @file expander_batch.c
+ * @author Hamza RAHAL
+ * @brief  lot de lectures/ecritures de registres envoyé en un seul transfert
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include "expander_batch.h"
+
+
+/**
+ **
+ * @brief   vide le lot
+ *
+ **/
+void expander_batch_init(expander_batch_t *b){
+
+    b->nmsgs = 0;
+}
+
+/**
+ **
+ * @brief   verifie qu'il reste n messages libres et que exp est sur le meme bus
+ *          que les expanders deja presents dans le lot
+ *
+ **/
+static int batch_check(expander_batch_t *b, expander_t *exp, int n){
+
+    if(b == NULL || exp == NULL)
+        return Er_Expander_Ecriture;
+    if(b->nmsgs + n > EXPANDER_BATCH_MAX_MSGS)
+        return Er_Expander_Ecriture;
+    if(b->nmsgs > 0 && b->exp[0]->bus != exp->bus)
+        return Er_I2C;
+    return 0;
+}
+
+/**
+ **
+ * @brief   ajoute l'ecriture d'un registre au lot
+ *
+ * @param   b lot
+ * @param   exp expander destinataire
+ * @param   reg registre a ecrire
+ * @param   val valeur a ecrire
+ *
+ * @return  0 si ok, code d'erreur si le lot est plein ou exp sur un autre bus
+ *
+ **/
+int expander_batch_write(expander_batch_t *b, expander_t *exp, uint8_t reg, uint8_t val){
+
+    int ret = batch_check(b, exp, 1);
+    if(ret < 0)
+        return ret;
+
+    int i = b->nmsgs++;
+
+    b->exp[i] = exp;
+    b->data[i][0] = reg;
+    b->data[i][1] = val;
+    b->msgs[i].addr = exp->addr;
+    b->msgs[i].flags = 0;
+    b->msgs[i].len = 2;
+    b->msgs[i].buf = b->data[i];
+    return 0;
+}
+
+/**
+ **
+ * @brief   ajoute la lecture d'un registre au lot, la valeur est ecrite dans
+ *          dst par expander_batch_flush
+ *
+ * @param   b lot
+ * @param   exp expander a lire
+ * @param   reg registre a lire
+ * @param   dst destination de la valeur lue
+ *
+ * @return  0 si ok, code d'erreur si le lot est plein ou exp sur un autre bus
+ *
+ **/
+int expander_batch_read(expander_batch_t *b, expander_t *exp, uint8_t reg, uint8_t *dst){
+
+    int ret = batch_check(b, exp, 2);
+    if(ret < 0)
+        return ret;
+
+    int i = b->nmsgs;
+    b->nmsgs += 2;
+
+    b->exp[i] = exp;
+    b->data[i][0] = reg;
+    b->msgs[i].addr = exp->addr;
+    b->msgs[i].flags = 0;
+    b->msgs[i].len = 1;
+    b->msgs[i].buf = b->data[i];
+
+    b->exp[i + 1] = exp;
+    b->msgs[i + 1].addr = exp->addr;
+    b->msgs[i + 1].flags = I2C_M_RD;
+    b->msgs[i + 1].len = 1;
+    b->msgs[i + 1].buf = dst;
+    return 0;
+}
+
+/**
+ **
+ * @brief   envoie tout le lot en un seul transfert (expander_transferMany : les
+ *          expanders du lot sont verrouillés dans l'ordre de leurs adresses et
+ *          chacun compte ses messages) puis le vide. Les copies locales des
+ *          expanders ne sont mises a jour que si tout est passé
+ *
+ * @param   b lot
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_batch_flush(expander_batch_t *b){
+
+    if(b == NULL)
+        return Er_Expander_Ecriture;
+    if(b->nmsgs == 0)
+        return 0;
+
+    int ret = expander_transferMany(b->exp, b->msgs, b->nmsgs);
+
+    if(ret == 0){
+        for(int i = 0; i < b->nmsgs; i++){
+
+            if(b->msgs[i].flags & I2C_M_RD)
+                continue;
+            if(b->msgs[i].len == 2)
+                expander_updateShadow(b->exp[i], b->data[i][0], b->data[i][1]);
+        }
+    }
+
+    b->nmsgs = 0;
+    return ret < 0 ? Er_I2C : 0;
+}
+
+/**
+ **
+ * @brief   ordre de verrouillage et de regroupement : par bus, puis par expander
+ *
+ **/
+static int update_cmp(const void *a, const void *b){
+
+    const expander_update_t *x = a, *y = b;
+
+    if(x->exp->bus != y->exp->bus)
+        return (uintptr_t)x->exp->bus < (uintptr_t)y->exp->bus ? -1 : 1;
+    if(x->exp != y->exp)
+        return (uintptr_t)x->exp < (uintptr_t)y->exp ? -1 : 1;
+    return 0;
+}
+
+/**
+ **
+ * @brief   applique des changements de pins sur plusieurs expanders avec le
+ *          minimum de transferts : les changements d'un meme expander sont
+ *          fusionnés (le dernier l'emporte), puis un seul transfert par bus
+ *          ecrit OLAT (et IODIR si besoin) de chaque expander qui change.
+ *          Pas de relecture ni d'attente settle_us sur ce chemin
+ *
+ * @param   u changements, dans l'ordre d'application
+ * @param   n nombre de changements
+ *
+ * @return  0 si ok, code d'erreur sinon (le premier rencontré)
+ *
+ **/
+int expander_batch_update(const expander_update_t *u, int n){
+
+    expander_batch_t b;
+    int nb = 0, ret = 0;
+
+    if(n <= 0)
+        return 0;
+    if(u == NULL)
+        return Er_Expander_Ecriture;
+
+    expander_update_t *m = malloc(n * sizeof(expander_update_t));
+    if(m == NULL)
+        return Er_Expander_Ecriture;
+
+    for(int i = 0; i < n; i++){
+
+        int j = 0;
+
+        if(u[i].exp == NULL){
+            free(m);
+            return Er_Expander_Ecriture;
+        }
+        while(j < nb && m[j].exp != u[i].exp)
+            j++;
+        if(j == nb){
+            m[nb].exp = u[i].exp;
+            m[nb].set = 0;
+            m[nb].clear = 0;
+            nb++;
+        }
+        m[j].set = (m[j].set & ~u[i].clear) | u[i].set;
+        m[j].clear = (m[j].clear & ~u[i].set) | u[i].clear;
+    }
+
+    // toujours dans le meme ordre : deux appels concurrents ne s'interbloquent pas
+    qsort(m, nb, sizeof(expander_update_t), update_cmp);
+    for(int i = 0; i < nb; i++)
+        expander_lock(m[i].exp);
+
+    expander_batch_init(&b);
+    for(int i = 0; i < nb && ret == 0; i++){
+
+        expander_t *exp = m[i].exp;
+        uint8_t olat = (exp->olat & ~m[i].clear) | m[i].set;
+        int nmsgs = (exp->iodir != exp->inputs) + (olat != exp->olat);
+
+        if(nmsgs == 0)
+            continue;
+
+        // autre bus ou lot plein : on envoie ce qui est pret
+        if(b.nmsgs > 0 && (b.exp[0]->bus != exp->bus || b.nmsgs + nmsgs > EXPANDER_BATCH_MAX_MSGS))
+            ret = expander_batch_flush(&b);
+
+        if(ret == 0 && exp->iodir != exp->inputs)
+            ret = expander_batch_write(&b, exp, MCP23008_IODIR, exp->inputs);
+        if(ret == 0 && olat != exp->olat)
+            ret = expander_batch_write(&b, exp, REG_OLAT, olat);
+    }
+    if(ret == 0)
+        ret = expander_batch_flush(&b);
+
+    for(int i = nb - 1; i >= 0; i--)
+        pthread_mutex_unlock(&m[i].exp->lock);
+    free(m);
+    return ret;
+}
@@ -0,0 +1,60 @@
+#ifndef _EXPANDER_BATCH_H
+#define _EXPANDER_BATCH_H
+
+/**
+ * @file expander_batch.h
+ * @author Hamza RAHAL
+ * @brief  lot de lectures/ecritures de registres, sur un ou plusieurs
+ *         expanders du meme bus, envoyé en un seul transfert I2C_RDWR
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include "MCP23017.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EXPANDER_BATCH_MAX_MSGS     I2C_RDWR_IOCTL_MAX_MSGS   // limite du noyau par ioctl
+
+/*
+ une ecriture occupe un message, une lecture deux (selection + lecture)
+*/
+typedef struct expander_batch
+{
+    struct i2c_msg msgs[EXPANDER_BATCH_MAX_MSGS];
+    expander_t *exp[EXPANDER_BATCH_MAX_MSGS];   // expander destinataire de chaque message
+    uint8_t data[EXPANDER_BATCH_MAX_MSGS][2];   // registre (+ valeur pour une ecriture)
+    int nmsgs;
+
+}expander_batch_t;
+
+/*
+ changement de pins de sortie d'un expander pour expander_batch_update
+*/
+typedef struct expander_update
+{
+    expander_t *exp;
+    uint8_t set;                // pins a mettre a 1
+    uint8_t clear;              // pins a mettre a 0 (set l'emporte)
+
+}expander_update_t;
+
+void expander_batch_init(expander_batch_t*);
+
+int expander_batch_write(expander_batch_t*, expander_t*, uint8_t reg, uint8_t val);
+int expander_batch_read(expander_batch_t*, expander_t*, uint8_t reg, uint8_t *dst);
+
+int expander_batch_flush(expander_batch_t*);
+
+int expander_batch_update(const expander_update_t*, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
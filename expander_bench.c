@@ -0,0 +1,143 @@
+/**
+ * @file expander_bench.c
+ * @author Hamza RAHAL
+ * @brief  banc de mesure : appelle chaque fonction de la librairie sur un
+ *         MCP23008 simulé et affiche latence p50/p99, appels systeme, octets
+ *         sur le fil, ecritures de OLAT et tours de boucle de reessai par appel
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * usage : expander_bench [-n iterations] [-c horloge_bus_hz]
+ *
+ * Licence Libre
+ *
+ */
+
+#include <time.h>
+#include "expander_sim.h"
+
+#define BENCH_ADDR      0x27
+
+typedef struct bench_op
+{
+    const char *nom;
+    void (*fn)(expander_t*, int);
+
+}bench_op_t;
+
+static void op_setPin(expander_t *e, int i)        { expander_setPinGPIO(e, i & 7); }
+static void op_resetPin(expander_t *e, int i)      { expander_resetPinGPIO(e, i & 7); }
+static void op_togglePin(expander_t *e, int i)     { expander_togglePinGPIO(e, i & 7); }
+static void op_getPin(expander_t *e, int i)        { expander_getPinGPIO(e, i & 7); }
+static void op_getAll(expander_t *e, int i)        { (void)i; expander_getAllPinsGPIO(e); }
+static void op_setAll(expander_t *e, int i)        { (void)i; expander_setAllPinsGPIO(e); }
+static void op_resetAll(expander_t *e, int i)      { (void)i; expander_resetAllPinsGPIO(e); }
+static void op_setOnly(expander_t *e, int i)       { expander_setOnlyPinResetOthersGPIO(e, i & 7); }
+static void op_resetOnly(expander_t *e, int i)     { expander_resetOnlyPinSetOthersGPIO(e, i & 7); }
+static void op_setAndReset(expander_t *e, int i)   { expander_setAndResetSomePinsGPIO(e, (uint8_t)(i * 37)); }
+static void op_setPullup(expander_t *e, int i)     { expander_setPullup(e, (uint8_t)i); }
+static void op_polGPIO(expander_t *e, int i)       { expander_polGPIO(e, (uint8_t)i); }
+
+static expander_state_t etat;    // rempli par snapshot, rejoué par restore
+static void op_snapshot(expander_t *e, int i)      { (void)i; expander_snapshot(e, &etat); }
+static void op_restore(expander_t *e, int i)       { (void)i; expander_restore(e, &etat); }
+static void op_scrub(expander_t *e, int i)         { (void)i; expander_scrub(e); }
+
+static const bench_op_t ops[] = {
+    { "setPinGPIO",                 op_setPin },
+    { "resetPinGPIO",               op_resetPin },
+    { "togglePinGPIO",              op_togglePin },
+    { "getPinGPIO",                 op_getPin },
+    { "getAllPinsGPIO",             op_getAll },
+    { "setAllPinsGPIO",             op_setAll },
+    { "resetAllPinsGPIO",           op_resetAll },
+    { "setOnlyPinResetOthersGPIO",  op_setOnly },
+    { "resetOnlyPinSetOthersGPIO",  op_resetOnly },
+    { "setAndResetSomePinsGPIO",    op_setAndReset },
+    { "setPullup",                  op_setPullup },
+    { "polGPIO",                    op_polGPIO },
+    { "snapshot",                   op_snapshot },
+    { "restore",                    op_restore },
+    { "scrub",                      op_scrub },
+};
+
+static uint64_t now_ns(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b){
+
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv){
+
+    int n = 1000;
+    uint32_t clock_hz = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:c:")) != -1){
+        switch(opt){
+            case 'n': n = atoi(optarg); break;
+            case 'c': clock_hz = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage : %s [-n iterations] [-c horloge_bus_hz]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(n <= 0)
+        n = 1;
+
+    uint64_t *lat = malloc(n * sizeof(uint64_t));
+    if(lat == NULL)
+        return EXIT_FAILURE;
+
+    expander_sim_t sim;
+    expander_sim_init(&sim, clock_hz);
+    expander_sim_addChip(&sim, BENCH_ADDR);
+
+    expander_t *exp = expander_initTransport(BENCH_ADDR, &expander_transport_sim, &sim);
+    if(exp == NULL)
+        return EXIT_FAILURE;
+
+    expander_sim_chip_t *chip = expander_sim_getChip(&sim, BENCH_ADDR);
+
+    if(clock_hz)
+        printf("MCP23008 simulé 0x%02x, %d iterations, bus %u Hz\n", BENCH_ADDR, n, clock_hz);
+    else
+        printf("MCP23008 simulé 0x%02x, %d iterations, bus instantané\n", BENCH_ADDR, n);
+    printf("%-28s %10s %10s %9s %8s %8s %8s %8s\n", "fonction", "p50(us)", "p99(us)", "syscalls", "msg", "octets", "OLAT", "reessais");
+
+    for(size_t k = 0; k < sizeof(ops) / sizeof(ops[0]); k++){
+
+        uint64_t reessais = 0;
+
+        expander_sim_resetCounters(&sim);
+        for(int i = 0; i < n; i++){
+
+            uint32_t olat = chip->nb_write[REG_OLAT];
+            uint64_t t0 = now_ns();
+            ops[k].fn(exp, i);
+            lat[i] = now_ns() - t0;
+
+            // chaque tour des boucles de verification reecrit OLAT
+            olat = chip->nb_write[REG_OLAT] - olat;
+            if(olat > 1)
+                reessais += olat - 1;
+        }
+        qsort(lat, n, sizeof(uint64_t), cmp_u64);
+
+        printf("%-28s %10.1f %10.1f %9.2f %8.2f %8.2f %8.2f %8.2f\n", ops[k].nom,
+               lat[n / 2] / 1000.0, lat[(n * 99) / 100] / 1000.0,
+               (double)sim.nb_xfer / n, (double)sim.nb_msg / n, (double)sim.nb_bytes / n,
+               (double)chip->nb_write[REG_OLAT] / n, (double)reessais / n);
+    }
+
+    expander_closeAndFree(exp);
+    free(lat);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#ifndef _EXPANDER_BOARD_HPP
+#define _EXPANDER_BOARD_HPP
+
+/**
+ * @file expander_board.hpp
+ * @author Hamza RAHAL
+ * @brief  description de la carte en C++17 : chaque pin est un type lié a son
+ *         expander a la compilation, les masques sont calculés a la compilation,
+ *         un pin > 7 ou un melange de pins de deux expanders ne compile pas
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include <cassert>
+#include <type_traits>
+#include "MCP23017.h"
+
+namespace mcp {
+
+/*
+ un expander de la carte, identifié par son adresse
+*/
+template<uint8_t Addr>
+struct Chip
+{
+    static_assert(Addr >= 0x20 && Addr <= 0x27, "un MCP23008 est entre 0x20 et 0x27");
+    static constexpr uint8_t addr = Addr;
+};
+
+/*
+ ensemble de pins d'un meme expander, masque connu a la compilation
+*/
+template<class C, uint8_t M>
+struct Mask
+{
+    using chip = C;
+    static constexpr uint8_t mask = M;
+};
+
+/*
+ un pin : un masque d'un seul bit
+*/
+template<class C, uint8_t N>
+struct Pin : Mask<C, (uint8_t)(1u << N)>
+{
+    static_assert(N < 8, "un MCP23008 a 8 pins (0 a 7)");
+    static constexpr uint8_t num = N;
+};
+
+template<class C1, uint8_t A, class C2, uint8_t B>
+constexpr Mask<C1, (uint8_t)(A | B)> operator|(Mask<C1, A>, Mask<C2, B>)
+{
+    static_assert(std::is_same<C1, C2>::value, "pins de deux expanders differents");
+    return {};
+}
+
+/*
+ acces aux pins d'un expander deja initialisé (ne le possede pas) : les
+ fonctions n'acceptent que des pins de C et passent des masques constants
+*/
+template<class C>
+class Port
+{
+public:
+    explicit Port(expander_t *exp) : exp_(exp)
+    {
+        assert(exp != nullptr && exp->addr == C::addr);
+    }
+
+    template<uint8_t M>
+    int set(Mask<C, M>) const { return expander_updatePinsGPIO(exp_, M, 0); }
+
+    template<uint8_t M>
+    int clear(Mask<C, M>) const { return expander_updatePinsGPIO(exp_, 0, M); }
+
+    template<uint8_t M>
+    int toggle(Mask<C, M>) const { return expander_togglePinsGPIO(exp_, M); }
+
+    // met a 1 S et a 0 R en une seule ecriture de OLAT
+    template<uint8_t S, uint8_t R>
+    int write(Mask<C, S>, Mask<C, R>) const
+    {
+        static_assert((S & R) == 0, "un pin ne peut pas etre mis a 1 et a 0");
+        return expander_updatePinsGPIO(exp_, S, R);
+    }
+
+    // met a 1 les pins de M et a 0 tous les autres
+    template<uint8_t M>
+    int only(Mask<C, M>) const { return expander_setAndResetSomePinsGPIO(exp_, M); }
+
+    // etat des pins de M lus sur GPIO (les autres a 0)
+    template<uint8_t M>
+    uint8_t read(Mask<C, M>) const { return expander_getAllPinsGPIO(exp_) & M; }
+
+    template<uint8_t N>
+    bool get(Pin<C, N>) const { return expander_getAllPinsGPIO(exp_) & (1u << N); }
+
+    expander_t* exp() const { return exp_; }
+
+private:
+    expander_t *exp_;
+};
+
+/*
+ la carte : memes numeros que les #define de MCP23017.h
+*/
+namespace board {
+
+using Exp26 = Chip<0x26>;
+using Exp27 = Chip<0x27>;
+
+inline constexpr Pin<Exp26, RCD_RESET>      rcd_reset{};
+inline constexpr Pin<Exp26, RCD_TST>        rcd_tst{};
+inline constexpr Pin<Exp26, RCD_DIS>        rcd_dis{};
+inline constexpr Pin<Exp26, LOCK_D>         lock_d{};
+inline constexpr Pin<Exp26, TYPE_E_F_ON>    type_e_f_on{};
+inline constexpr Pin<Exp26, TYPE_2_L2L3_ON> type_2_l2l3_on{};
+inline constexpr Pin<Exp26, TYPE_2_NL1_ON>  type_2_nl1_on{};
+
+inline constexpr Pin<Exp27, PM0>            pm0{};
+inline constexpr Pin<Exp27, PM1>            pm1{};
+inline constexpr Pin<Exp27, PM_CS>          pm_cs{};
+inline constexpr Pin<Exp27, T_CS>           t_cs{};
+inline constexpr Pin<Exp27, CP_CS>          cp_cs{};
+inline constexpr Pin<Exp27, PP_CS>          pp_cs{};
+inline constexpr Pin<Exp27, CP_DIS>         cp_dis{};
+inline constexpr Pin<Exp27, LED_DIS>        led_dis{};
+
+// tous les chip selects de 0x27, pour les changer en une seule ecriture
+inline constexpr auto all_cs = pm_cs | t_cs | cp_cs | pp_cs;
+
+} // namespace board
+
+} // namespace mcp
+
+#endif
@@ -0,0 +1,963 @@
+/**
+ * @file expander_bus.c
+ * @author Hamza RAHAL
+ * @brief  gestion des bus : un descripteur par adaptateur partagé par tous
+ *         les expanders, adressage par message (I2C_RDWR) et transport i2c-dev
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include "expander_trace.h"
+
+
+static expander_bus_t *bus_list = NULL;                         // bus ouverts
+static pthread_mutex_t bus_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ transfert en attente du bus (sur la pile de son thread)
+*/
+typedef struct expander_waiter
+{
+    int prio;
+    uint64_t wire_ns;           // temps sur le fil estimé de ce transfert
+    uint64_t skipped_ns;        // temps de bus estimé passé devant lui
+    int granted;
+    pthread_cond_t cond;
+    struct expander_waiter *next;
+
+}expander_waiter_t;
+
+
+
+static const char *method_name[] = {
+    [EXPANDER_METHOD_RDWR] = "I2C_RDWR",
+    [EXPANDER_METHOD_SMBUS] = "I2C_SMBUS",
+    [EXPANDER_METHOD_RW] = "read/write",
+};
+
+
+
+/**
+ **
+ * @brief   vrai si l'adaptateur sait faire la methode m
+ *
+ **/
+static int method_supported(const expander_bus_t *bus, expander_method_t m){
+
+    switch(m){
+        case EXPANDER_METHOD_RDWR:  return (bus->funcs & I2C_FUNC_I2C) != 0;
+        case EXPANDER_METHOD_SMBUS: return (bus->funcs & I2C_FUNC_SMBUS_BYTE_DATA) == I2C_FUNC_SMBUS_BYTE_DATA;
+        case EXPANDER_METHOD_RW:    return 1;
+        default:                    return 0;
+    }
+}
+
+/**
+ **
+ * @brief   ouvre l'adaptateur bus->path (transport i2c-dev), lit ce qu'il sait
+ *          faire (I2C_FUNCS) et choisit la methode d'acces la plus rapide
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+static int i2cdev_open(expander_bus_t *bus){
+
+    bus->fd = open(bus->path, O_RDWR);
+    if(bus->fd < 0) {
+
+#ifdef DEBUG
+        printf("Warning fonction %s : pas pu ouvrir l'i2c on retente apres 1sec\n", __func__);
+#endif
+        sleep(1);
+
+        bus->fd = open(bus->path, O_RDWR);
+        if(bus->fd < 0) {
+
+            fprintf(stderr, "fonction %s: Unable to open i2c device: %s\n", __func__, strerror(errno));
+            return Er_Ouverture;
+        }
+
+    }
+
+    if(ioctl(bus->fd, I2C_FUNCS, &bus->funcs) < 0)
+        bus->funcs = 0;
+
+    if(method_supported(bus, EXPANDER_METHOD_RDWR))
+        bus->method = EXPANDER_METHOD_RDWR;
+    else if(method_supported(bus, EXPANDER_METHOD_SMBUS))
+        bus->method = EXPANDER_METHOD_SMBUS;
+    else
+        bus->method = EXPANDER_METHOD_RW;
+
+#ifdef DEBUG
+    printf("%s : I2C_FUNCS 0x%08lx, acces par %s\n", bus->path, bus->funcs, method_name[bus->method]);
+#endif
+    return 0;
+}
+
+/**
+ **
+ * @brief   ferme l'adaptateur (transport i2c-dev)
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+static int i2cdev_close(expander_bus_t *bus){
+
+    if(close(bus->fd) < 0) {
+
+        fprintf(stderr, "fonction %s: Unable to close i2c device: %s\n", __func__, strerror(errno));
+        return Er_Fermeture;
+    }
+    bus->fd = -1;
+    return 0;
+}
+
+/**
+ **
+ * @brief   selectionne l'esclave pour SMBus et read/write (une fois par adresse)
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+static int i2cdev_slave(expander_bus_t *bus, uint16_t addr){
+
+    if(bus->slave == addr)
+        return 0;
+    if(ioctl(bus->fd, I2C_SLAVE, addr) < 0){
+        bus->slave = -1;
+        return Er_I2C;
+    }
+    bus->slave = addr;
+    return 0;
+}
+
+static int smbus_access(expander_bus_t *bus, char rw, uint8_t cmd, int size, union i2c_smbus_data *data){
+
+    struct i2c_smbus_ioctl_data args;
+
+    args.read_write = rw;
+    args.command = cmd;
+    args.size = size;
+    args.data = data;
+    return ioctl(bus->fd, I2C_SMBUS, &args) < 0 ? Er_I2C : 0;
+}
+
+/**
+ **
+ * @brief   lit len registres a partir de reg par SMBus : une rafale i2c-block
+ *          si l'adaptateur sait la faire, sinon registre par registre
+ *
+ **/
+static int smbus_read(expander_bus_t *bus, uint8_t reg, uint8_t *buf, int len){
+
+    union i2c_smbus_data data;
+
+    if(len > 1 && len <= I2C_SMBUS_BLOCK_MAX && (bus->funcs & I2C_FUNC_SMBUS_READ_I2C_BLOCK)){
+
+        data.block[0] = len;
+        if(smbus_access(bus, I2C_SMBUS_READ, reg, I2C_SMBUS_I2C_BLOCK_DATA, &data) < 0 || data.block[0] != len)
+            return Er_I2C;
+        memcpy(buf, &data.block[1], len);
+        return 0;
+    }
+    for(int j = 0; j < len; j++){
+
+        if(smbus_access(bus, I2C_SMBUS_READ, reg + j, I2C_SMBUS_BYTE_DATA, &data) < 0)
+            return Er_I2C;
+        buf[j] = data.byte;
+    }
+    return 0;
+}
+
+/**
+ **
+ * @brief   ecrit len registres a partir de reg par SMBus
+ *
+ **/
+static int smbus_write(expander_bus_t *bus, uint8_t reg, const uint8_t *buf, int len){
+
+    union i2c_smbus_data data;
+
+    if(len > 1 && len <= I2C_SMBUS_BLOCK_MAX && (bus->funcs & I2C_FUNC_SMBUS_WRITE_I2C_BLOCK)){
+
+        data.block[0] = len;
+        memcpy(&data.block[1], buf, len);
+        return smbus_access(bus, I2C_SMBUS_WRITE, reg, I2C_SMBUS_I2C_BLOCK_DATA, &data);
+    }
+    for(int j = 0; j < len; j++){
+
+        data.byte = buf[j];
+        if(smbus_access(bus, I2C_SMBUS_WRITE, reg + j, I2C_SMBUS_BYTE_DATA, &data) < 0)
+            return Er_I2C;
+    }
+    return 0;
+}
+
+/**
+ **
+ * @brief   traduit les messages en commandes SMBus : selection de registre +
+ *          lecture -> read byte/i2c-block data, ecriture -> write byte/i2c-block data
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+static int smbus_xfer(expander_bus_t *bus, struct i2c_msg *msgs, int nmsgs){
+
+    union i2c_smbus_data data;
+
+    for(int i = 0; i < nmsgs; i++){
+
+        struct i2c_msg *m = &msgs[i];
+        int ret;
+
+        if(i2cdev_slave(bus, m->addr) < 0)
+            return Er_I2C;
+
+        if(!(m->flags & I2C_M_RD) && m->len == 1 && i + 1 < nmsgs
+           && (msgs[i + 1].flags & I2C_M_RD) && msgs[i + 1].addr == m->addr){
+
+            ret = smbus_read(bus, m->buf[0], msgs[i + 1].buf, msgs[i + 1].len);
+            i++;
+        }
+        else if(m->flags & I2C_M_RD){
+
+            // lecture au pointeur courant du MCP23008
+            ret = 0;
+            for(int j = 0; j < m->len && ret == 0; j++){
+                ret = smbus_access(bus, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &data);
+                m->buf[j] = data.byte;
+            }
+        }
+        else if(m->len == 1)
+            ret = smbus_access(bus, I2C_SMBUS_WRITE, m->buf[0], I2C_SMBUS_BYTE, NULL);
+        else if(m->len > 1)
+            ret = smbus_write(bus, m->buf[0], m->buf + 1, m->len - 1);
+        else
+            ret = 0;
+
+        if(ret < 0)
+            return Er_I2C;
+    }
+    return 0;
+}
+
+/**
+ **
+ * @brief   un write() ou read() par message. Sans repeated start : le verrou du
+ *          bus empeche seulement les autres utilisateurs de la librairie de
+ *          s'intercaler
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+static int rw_xfer(expander_bus_t *bus, struct i2c_msg *msgs, int nmsgs){
+
+    for(int i = 0; i < nmsgs; i++){
+
+        struct i2c_msg *m = &msgs[i];
+        ssize_t n;
+
+        if(i2cdev_slave(bus, m->addr) < 0)
+            return Er_I2C;
+
+        if(m->flags & I2C_M_RD)
+            n = read(bus->fd, m->buf, m->len);
+        else
+            n = write(bus->fd, m->buf, m->len);
+
+        if(n != m->len)
+            return Er_I2C;
+    }
+    return 0;
+}
+
+/**
+ **
+ * @brief   execute des messages i2c avec la methode choisie a l'ouverture ;
+ *          avec I2C_RDWR tout passe en un seul ioctl et chaque message porte
+ *          l'adresse de son expander, pas besoin de I2C_SLAVE
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+static int i2cdev_xfer(expander_bus_t *bus, struct i2c_msg *msgs, int nmsgs){
+
+    struct i2c_rdwr_ioctl_data xfer;
+
+    switch(bus->method){
+
+        case EXPANDER_METHOD_SMBUS: return smbus_xfer(bus, msgs, nmsgs);
+        case EXPANDER_METHOD_RW:    return rw_xfer(bus, msgs, nmsgs);
+        default:                    break;
+    }
+
+    xfer.msgs = msgs;
+    xfer.nmsgs = nmsgs;
+
+    if(ioctl(bus->fd, I2C_RDWR, &xfer) != nmsgs)
+        return Er_I2C;
+    return 0;
+}
+
+const expander_transport_t expander_transport_i2cdev = {
+    .name = "i2c-dev",
+    .open = i2cdev_open,
+    .close = i2cdev_close,
+    .xfer = i2cdev_xfer,
+};
+
+
+
+/**
+ **
+ * @brief   bus ouvert pour (tr, path, ctx), NULL si aucun. bus_list_lock tenu
+ *
+ **/
+static expander_bus_t* bus_find(const expander_transport_t *tr, const char *path, void *ctx){
+
+    for(expander_bus_t *bus = bus_list; bus != NULL; bus = bus->next){
+        if(bus->tr == tr && bus->tr_ctx == ctx && strcmp(bus->path, path) == 0)
+            return bus;
+    }
+    return NULL;
+}
+
+/**
+ **
+ * @brief   libere un bus qui n'est pas (ou plus) dans bus_list
+ *
+ **/
+static void bus_free(expander_bus_t *bus){
+
+    pthread_cond_destroy(&bus->scrub_cond);
+    pthread_cond_destroy(&bus->scrub_done);
+    pthread_mutex_destroy(&bus->scrub_lock);
+    pthread_mutex_destroy(&bus->sched_lock);
+    pthread_mutex_destroy(&bus->lock);
+    free(bus);
+}
+
+/**
+ **
+ * @brief   renvoie le bus deja ouvert pour (tr, path, ctx) ou l'ouvre, et prend
+ *          une reference dessus. L'ouverture (qui peut attendre 1 s) se fait
+ *          sans tenir bus_list_lock ; si un autre thread a ouvert le meme bus
+ *          entre temps, c'est le sien qui est partagé
+ *
+ **/
+static expander_bus_t* bus_get(const expander_transport_t *tr, const char *path, void *ctx){
+
+    expander_bus_t *bus, *deja;
+
+    pthread_mutex_lock(&bus_list_lock);
+    bus = bus_find(tr, path, ctx);
+    if(bus != NULL)
+        bus->refcount++;
+    pthread_mutex_unlock(&bus_list_lock);
+    if(bus != NULL)
+        return bus;
+
+    bus = malloc(sizeof(expander_bus_t));
+    if(bus == NULL){
+        printf("ERREUR %s : allocation echouee\n", __func__);
+        return NULL;
+    }
+    bus->fd = -1;
+    snprintf(bus->path, sizeof(bus->path), "%s", path);
+    bus->tr = tr;
+    bus->tr_ctx = ctx;
+    bus->refcount = 1;
+    bus->nb_xfer = 0;
+    bus->nb_bytes = 0;
+    bus->busy_ns = 0;
+    bus->funcs = I2C_FUNC_I2C;          // les autres transports prennent les messages tels quels
+    bus->method = EXPANDER_METHOD_RDWR;
+    bus->slave = -1;
+    bus->clock_hz = EXPANDER_BUS_CLOCK_HZ;
+    bus->sched_busy = 0;
+    bus->waiters = NULL;
+    memset(bus->prio_xfer, 0, sizeof(bus->prio_xfer));
+    memset(bus->prio_wire_ns, 0, sizeof(bus->prio_wire_ns));
+    memset(bus->prio_busy_ns, 0, sizeof(bus->prio_busy_ns));
+    memset(bus->prio_wait_ns, 0, sizeof(bus->prio_wait_ns));
+    memset(bus->prio_max_wait_ns, 0, sizeof(bus->prio_max_wait_ns));
+    pthread_mutex_init(&bus->sched_lock, NULL);
+    pthread_mutex_init(&bus->lock, NULL);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bus->scrub_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    pthread_cond_init(&bus->scrub_done, NULL);
+    pthread_mutex_init(&bus->scrub_lock, NULL);
+    bus->scrub_started = 0;
+    bus->scrub_stop = 0;
+    bus->scrub_period_ms = EXPANDER_SCRUB_PERIOD_MS;
+    bus->scrub_list = NULL;
+
+    if(tr->open(bus) < 0){
+        bus_free(bus);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&bus_list_lock);
+    deja = bus_find(tr, path, ctx);
+    if(deja != NULL){
+
+        deja->refcount++;
+        pthread_mutex_unlock(&bus_list_lock);
+        tr->close(bus);
+        bus_free(bus);
+        return deja;
+    }
+
+    // toujours active : 4 Ko par bus, quelques dizaines de ns par transfert
+    bus->trace = expander_trace_open(NULL, 0);
+    if(bus->trace != NULL)
+        snprintf(bus->trace->path, sizeof(bus->trace->path), "%s", path);
+
+    bus->next = bus_list;
+    bus_list = bus;
+    pthread_mutex_unlock(&bus_list_lock);
+    return bus;
+}
+
+/**
+ **
+ * @brief   ouvre (ou partage) l'adaptateur i2c-dev path, ex: "/dev/i2c-1"
+ *
+ * @param   path chemin de l'adaptateur
+ *
+ * @return  le bus, a rendre avec expander_bus_close, NULL si echec
+ *
+ **/
+expander_bus_t* expander_bus_open(const char *path){
+
+    if(path == NULL)
+        return NULL;
+    return bus_get(&expander_transport_i2cdev, path, NULL);
+}
+
+/**
+ **
+ * @brief   ouvre (ou partage) le bus d'un autre transport, ex: un bus simulé
+ *
+ * @param   tr transport
+ * @param   ctx contexte du transport (ex: expander_sim_t*)
+ *
+ * @return  le bus, a rendre avec expander_bus_close, NULL si echec
+ *
+ **/
+expander_bus_t* expander_bus_openTransport(const expander_transport_t *tr, void *ctx){
+
+    if(tr == NULL)
+        return NULL;
+    return bus_get(tr, tr->name, ctx);
+}
+
+/**
+ **
+ * @brief   prend une reference supplementaire sur un bus deja ouvert
+ *
+ **/
+void expander_bus_ref(expander_bus_t *bus){
+
+    pthread_mutex_lock(&bus_list_lock);
+    bus->refcount++;
+    pthread_mutex_unlock(&bus_list_lock);
+}
+
+/**
+ **
+ * @brief   rend une reference sur le bus, le ferme quand plus personne ne l'utilise
+ *
+ **/
+void expander_bus_close(expander_bus_t *bus){
+
+    if(bus == NULL)
+        return;
+
+    pthread_mutex_lock(&bus_list_lock);
+    if(--bus->refcount > 0){
+        pthread_mutex_unlock(&bus_list_lock);
+        return;
+    }
+
+    expander_bus_t **p = &bus_list;
+    while(*p != NULL && *p != bus)
+        p = &(*p)->next;
+    if(*p != NULL)
+        *p = bus->next;
+    pthread_mutex_unlock(&bus_list_lock);
+
+    if(bus->scrub_started){
+
+        pthread_mutex_lock(&bus->scrub_lock);
+        bus->scrub_stop = 1;
+        pthread_cond_signal(&bus->scrub_cond);
+        pthread_mutex_unlock(&bus->scrub_lock);
+        pthread_join(bus->scrub_thread, NULL);
+    }
+
+    bus->tr->close(bus);
+    expander_trace_close(bus->trace);
+    bus_free(bus);
+}
+
+/**
+ **
+ * @brief   temps sur le fil estimé d'un transfert : 9 bits par octet (adresse
+ *          comprise) plus start et stop/repeated start, a l'horloge du bus
+ *
+ * @return  duree estimée en ns
+ *
+ **/
+uint64_t expander_bus_wireTime(const expander_bus_t *bus, const struct i2c_msg *msgs, int nmsgs){
+
+    uint64_t bits = 0;
+
+    for(int i = 0; i < nmsgs; i++)
+        bits += 9 * (1 + (uint64_t)msgs[i].len) + 2;
+    return bits * 1000000000ull / (bus->clock_hz ? bus->clock_hz : EXPANDER_BUS_CLOCK_HZ);
+}
+
+/**
+ **
+ * @brief   change l'horloge du bus utilisée pour l'estimation (100 kHz par defaut)
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_bus_setClock(expander_bus_t *bus, uint32_t hz){
+
+    if(bus == NULL || hz == 0)
+        return Er_I2C;
+    bus->clock_hz = hz;
+    return 0;
+}
+
+/**
+ **
+ * @brief   attend son tour pour le bus : libre, on le prend ; sinon on se met
+ *          en file et celui qui le rend nous le passe directement. Avec inh, la
+ *          priorité est au moins celle des threads bloqués sur le verrou de
+ *          l'expander, et ceux qui s'y bloquent pendant l'attente la relevent
+ *
+ * @param   prio priorité demandée, recoit celle avec laquelle le bus a été obtenu
+ *
+ * @return  temps d'attente en ns
+ *
+ **/
+static uint64_t sched_acquire(expander_bus_t *bus, int *prio, uint64_t wire_ns, expander_inherit_t *inh){
+
+    expander_waiter_t w, **p;
+    struct timespec t0, t1;
+
+    pthread_mutex_lock(&bus->sched_lock);
+    if(inh != NULL){
+        for(int i = EXPANDER_NB_PRIO - 1; i > *prio; i--){
+            if(inh->nb_wait[i]){
+                *prio = i;
+                break;
+            }
+        }
+    }
+    if(!bus->sched_busy){
+        bus->sched_busy = 1;
+        pthread_mutex_unlock(&bus->sched_lock);
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    w.prio = *prio;
+    w.wire_ns = wire_ns;
+    w.skipped_ns = 0;
+    w.granted = 0;
+    w.next = NULL;
+    pthread_cond_init(&w.cond, NULL);
+    for(p = &bus->waiters; *p != NULL; p = &(*p)->next)
+        ;
+    *p = &w;
+    if(inh != NULL)
+        inh->queued = &w;
+
+    while(!w.granted)
+        pthread_cond_wait(&w.cond, &bus->sched_lock);
+    if(inh != NULL)
+        inh->queued = NULL;
+    *prio = w.prio;
+    pthread_mutex_unlock(&bus->sched_lock);
+
+    pthread_cond_destroy(&w.cond);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0.tv_sec) * 1000000000ll + (t1.tv_nsec - t0.tv_nsec);
+}
+
+/**
+ **
+ * @brief   note un thread qui se bloque (delta 1) ou ne l'est plus (delta -1)
+ *          sur le verrou d'un expander ; s'il se bloque, le transfert que le
+ *          detenteur a en file prend sa priorité si elle est superieure
+ *
+ **/
+void expander_bus_inherit(expander_bus_t *bus, expander_inherit_t *inh, int prio, int delta){
+
+    if(bus == NULL || inh == NULL || prio < 0 || prio >= EXPANDER_NB_PRIO)
+        return;
+
+    pthread_mutex_lock(&bus->sched_lock);
+    inh->nb_wait[prio] += delta;
+    if(delta > 0 && inh->queued != NULL && inh->queued->prio < prio)
+        inh->queued->prio = prio;
+    pthread_mutex_unlock(&bus->sched_lock);
+}
+
+/**
+ **
+ * @brief   rend le bus : il passe au plus prioritaire des transferts en attente
+ *          (le plus ancien a priorité egale), ou a celui qui a deja laissé passer
+ *          EXPANDER_SCHED_BUDGET_US de temps de bus devant lui
+ *
+ **/
+static void sched_release(expander_bus_t *bus){
+
+    expander_waiter_t **best = NULL, **p, *w;
+    int best_prio = -1;
+
+    pthread_mutex_lock(&bus->sched_lock);
+    for(p = &bus->waiters; *p != NULL; p = &(*p)->next){
+
+        int prio = (*p)->skipped_ns >= EXPANDER_SCHED_BUDGET_US * 1000ull ? EXPANDER_NB_PRIO : (*p)->prio;
+        if(prio > best_prio){
+            best_prio = prio;
+            best = p;
+        }
+    }
+
+    if(best == NULL){
+        bus->sched_busy = 0;
+        pthread_mutex_unlock(&bus->sched_lock);
+        return;
+    }
+
+    w = *best;
+    *best = w->next;
+    for(expander_waiter_t *o = bus->waiters; o != NULL; o = o->next)
+        o->skipped_ns += w->wire_ns;
+
+    w->granted = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&bus->sched_lock);
+}
+
+/**
+ **
+ * @brief   execute des messages sur le bus, qui peuvent viser plusieurs expanders,
+ *          sans qu'un autre transfert ne s'intercale (priorité normale)
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_bus_transfer(expander_bus_t *bus, struct i2c_msg *msgs, int nmsgs){
+
+    return expander_bus_transferPrio(bus, msgs, nmsgs, EXPANDER_PRIO_NORMAL);
+}
+
+/**
+ **
+ * @brief   comme expander_bus_transfer, en passant devant les transferts en
+ *          attente de priorité inferieure
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_bus_transferPrio(expander_bus_t *bus, struct i2c_msg *msgs, int nmsgs, expander_prio_t prio){
+
+    return expander_bus_transferInherit(bus, msgs, nmsgs, prio, NULL);
+}
+
+/**
+ **
+ * @brief   comme expander_bus_transferPrio pour le detenteur du verrou d'un
+ *          expander : inh (expander_t.inherit) releve la priorité du transfert
+ *          si des threads plus prioritaires attendent ce verrou
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_bus_transferInherit(expander_bus_t *bus, struct i2c_msg *msgs, int nmsgs,
+                                 expander_prio_t p, expander_inherit_t *inh){
+
+    struct timespec t0, t1;
+    int prio = p >= EXPANDER_NB_PRIO ? EXPANDER_PRIO_CRITICAL : (int)p;
+
+    uint64_t wire_ns = expander_bus_wireTime(bus, msgs, nmsgs);
+    uint64_t wait_ns = sched_acquire(bus, &prio, wire_ns, inh);
+
+    pthread_mutex_lock(&bus->lock);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int ret = bus->tr->xfer(bus, msgs, nmsgs);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    uint64_t ns = (t1.tv_sec - t0.tv_sec) * 1000000000ll + (t1.tv_nsec - t0.tv_nsec);
+
+    bus->nb_xfer++;
+    for(int i = 0; i < nmsgs; i++)
+        bus->nb_bytes += msgs[i].len;
+    bus->busy_ns += ns;
+    bus->prio_xfer[prio]++;
+    bus->prio_wire_ns[prio] += wire_ns;
+    bus->prio_busy_ns[prio] += ns;
+    bus->prio_wait_ns[prio] += wait_ns;
+    if(wait_ns > bus->prio_max_wait_ns[prio])
+        bus->prio_max_wait_ns[prio] = wait_ns;
+    if(bus->trace != NULL)
+        expander_trace_record(bus->trace, msgs, nmsgs, ret, &t0, &t1);
+    pthread_mutex_unlock(&bus->lock);
+
+    sched_release(bus);
+    return ret;
+}
+
+/**
+ **
+ * @brief   copie les mesures du bus (transferts, octets, temps d'occupation)
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_bus_getStats(expander_bus_t *bus, expander_bus_stats_t *st){
+
+    if(bus == NULL || st == NULL)
+        return Er_Expander_Ecriture;
+
+    pthread_mutex_lock(&bus->lock);
+    st->nb_xfer = bus->nb_xfer;
+    st->nb_bytes = bus->nb_bytes;
+    st->busy_ns = bus->busy_ns;
+    memcpy(st->prio_xfer, bus->prio_xfer, sizeof(st->prio_xfer));
+    memcpy(st->prio_wire_ns, bus->prio_wire_ns, sizeof(st->prio_wire_ns));
+    memcpy(st->prio_busy_ns, bus->prio_busy_ns, sizeof(st->prio_busy_ns));
+    memcpy(st->prio_wait_ns, bus->prio_wait_ns, sizeof(st->prio_wait_ns));
+    memcpy(st->prio_max_wait_ns, bus->prio_max_wait_ns, sizeof(st->prio_max_wait_ns));
+    pthread_mutex_unlock(&bus->lock);
+    return 0;
+}
+
+/**
+ **
+ * @brief   remet a zero les mesures du bus
+ *
+ **/
+void expander_bus_resetStats(expander_bus_t *bus){
+
+    if(bus == NULL)
+        return;
+
+    pthread_mutex_lock(&bus->lock);
+    bus->nb_xfer = 0;
+    bus->nb_bytes = 0;
+    bus->busy_ns = 0;
+    memset(bus->prio_xfer, 0, sizeof(bus->prio_xfer));
+    memset(bus->prio_wire_ns, 0, sizeof(bus->prio_wire_ns));
+    memset(bus->prio_busy_ns, 0, sizeof(bus->prio_busy_ns));
+    memset(bus->prio_wait_ns, 0, sizeof(bus->prio_wait_ns));
+    memset(bus->prio_max_wait_ns, 0, sizeof(bus->prio_max_wait_ns));
+    pthread_mutex_unlock(&bus->lock);
+}
+
+/**
+ **
+ * @brief   remplace la trace du bus, ex: par un fichier mappé qui survit a un
+ *          plantage. A appeler avant de lire la trace depuis un autre thread
+ *
+ * @param   bus bus
+ * @param   file fichier de trace, NULL pour un anneau en memoire
+ * @param   depth nombre d'entrees, 0 pour couper la trace
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_bus_trace(expander_bus_t *bus, const char *file, unsigned int depth){
+
+    expander_trace_t *trace = NULL;
+
+    if(bus == NULL)
+        return Er_Ouverture;
+
+    if(depth){
+        trace = expander_trace_open(file, depth);
+        if(trace == NULL)
+            return Er_Ouverture;
+        snprintf(trace->path, sizeof(trace->path), "%s", bus->path);
+    }
+
+    pthread_mutex_lock(&bus->lock);
+    expander_trace_t *old = bus->trace;
+    bus->trace = trace;
+    pthread_mutex_unlock(&bus->lock);
+
+    expander_trace_close(old);
+    return 0;
+}
+
+/**
+ **
+ * @brief   impose une methode d'acces (ex: pour comparer), si l'adaptateur la
+ *          sait faire
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_bus_setMethod(expander_bus_t *bus, expander_method_t m){
+
+    if(bus == NULL || bus->tr != &expander_transport_i2cdev || !method_supported(bus, m))
+        return Er_I2C;
+
+    pthread_mutex_lock(&bus->lock);
+    bus->method = m;
+    bus->slave = -1;
+    pthread_mutex_unlock(&bus->lock);
+    return 0;
+}
+
+/**
+ **
+ * @brief   nom de la methode d'acces utilisée sur le bus
+ *
+ **/
+const char* expander_bus_methodName(const expander_bus_t *bus){
+
+    if(bus == NULL)
+        return "?";
+    if(bus->tr != &expander_transport_i2cdev)
+        return bus->tr->name;
+    return method_name[bus->method];
+}
+
+/**
+ **
+ * @brief   thread de controle de fond du bus : toutes les scrub_period_ms,
+ *          expander_scrub sur chaque expander en EXPANDER_VERIFY_SCRUB, en
+ *          priorité EXPANDER_PRIO_BACKGROUND. Les echeances sont absolues
+ *
+ **/
+static void* scrub_thread(void *arg){
+
+    expander_bus_t *bus = arg;
+    struct timespec echeance;
+
+    expander_setThreadPriority(EXPANDER_PRIO_BACKGROUND);
+    clock_gettime(CLOCK_MONOTONIC, &echeance);
+
+    pthread_mutex_lock(&bus->scrub_lock);
+    while(!bus->scrub_stop){
+
+        uint64_t ns = echeance.tv_nsec + (uint64_t)bus->scrub_period_ms * 1000000ull;
+        echeance.tv_sec += ns / 1000000000ull;
+        echeance.tv_nsec = ns % 1000000000ull;
+
+        while(!bus->scrub_stop &&
+              pthread_cond_timedwait(&bus->scrub_cond, &bus->scrub_lock, &echeance) != ETIMEDOUT)
+            ;
+        if(bus->scrub_stop)
+            break;
+
+        // copie de la liste, chaque expander epinglé : le verrou de la liste
+        // n'est pas tenu pendant les controles, et expander_closeI2C attend
+        // que l'expander qu'il retire soit relaché
+        int n = 0;
+        for(expander_t *e = bus->scrub_list; e != NULL; e = e->scrub_next)
+            n++;
+        if(n == 0)
+            continue;
+
+        expander_t *copie[n];
+        n = 0;
+        for(expander_t *e = bus->scrub_list; e != NULL; e = e->scrub_next){
+            e->scrub_pin++;
+            copie[n++] = e;
+        }
+        pthread_mutex_unlock(&bus->scrub_lock);
+
+        for(int i = 0; i < n; i++){
+
+            expander_t *e = copie[i];
+            expander_lock(e);
+            if(e->verify == EXPANDER_VERIFY_SCRUB)
+                expander_scrub(e);
+            pthread_mutex_unlock(&e->lock);
+        }
+
+        pthread_mutex_lock(&bus->scrub_lock);
+        for(int i = 0; i < n; i++)
+            copie[i]->scrub_pin--;
+        pthread_cond_broadcast(&bus->scrub_done);
+    }
+    pthread_mutex_unlock(&bus->scrub_lock);
+    return NULL;
+}
+
+/**
+ **
+ * @brief   ajoute (on) ou retire un expander de la liste de controle de fond
+ *          du bus ; le thread est demarré au premier ajout. Un retrait attend
+ *          la fin du controle en cours. A appeler sans tenir le verrou de
+ *          l'expander
+ *
+ **/
+void expander_bus_scrubWatch(expander_bus_t *bus, expander_t *exp, int on){
+
+    if(bus == NULL || exp == NULL)
+        return;
+
+    pthread_mutex_lock(&bus->scrub_lock);
+
+    expander_t **p = &bus->scrub_list;
+    while(*p != NULL && *p != exp)
+        p = &(*p)->scrub_next;
+
+    if(!on && *p != NULL){
+
+        *p = exp->scrub_next;
+        while(exp->scrub_pin > 0)
+            pthread_cond_wait(&bus->scrub_done, &bus->scrub_lock);
+    }
+    else if(on && *p == NULL){
+
+        exp->scrub_next = bus->scrub_list;
+        bus->scrub_list = exp;
+        if(!bus->scrub_started){
+
+            if(pthread_create(&bus->scrub_thread, NULL, scrub_thread, bus) == 0)
+                bus->scrub_started = 1;
+            else
+                fprintf(stderr, "fonction %s: Unable to start scrub thread\n", __func__);
+        }
+    }
+    pthread_mutex_unlock(&bus->scrub_lock);
+}
+
+/**
+ **
+ * @brief   change la periode du controle de fond (EXPANDER_VERIFY_SCRUB),
+ *          prise en compte a l'echeance suivante
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_bus_setScrubPeriod(expander_bus_t *bus, uint32_t ms){
+
+    if(bus == NULL || ms == 0)
+        return Er_Ecriture;
+
+    pthread_mutex_lock(&bus->scrub_lock);
+    bus->scrub_period_ms = ms;
+    pthread_mutex_unlock(&bus->scrub_lock);
+    return 0;
+}
@@ -0,0 +1,1092 @@
+/**
+ * @file expander_check.c
+ * @author Hamza RAHAL
+ * @brief  verifications de non regression sur des MCP23008 simulés.
+ *         Affiche une ligne par verification et sort en echec si l'une rate
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * usage : expander_check
+ *
+ * Licence Libre
+ *
+ */
+
+#include <poll.h>
+#include <sys/syscall.h>
+#include "expander_sim.h"
+#include "expander_pool.h"
+#include "expander_irq.h"
+#include "expander_batch.h"
+#include "expander_trace.h"
+#include "expander_sampler.h"
+#include "expander_debounce.h"
+
+static int nb_echecs = 0;
+
+#define CHECK(cond) do{                                                         \
+        if(!(cond)){                                                            \
+            printf("    ECHEC ligne %d : %s\n", __LINE__, #cond);               \
+            nb_echecs++;                                                        \
+        }                                                                       \
+    }while(0)
+
+/*
+ ecritures recues par un MCP simulé depuis resetCounters
+*/
+static uint32_t nb_writes(expander_sim_t *sim, uint8_t addr){
+
+    expander_sim_chip_t *c = expander_sim_getChip(sim, addr);
+    uint32_t n = 0;
+
+    for(int i = 0; i < EXPANDER_SIM_NB_REG; i++)
+        n += c->nb_write[i];
+    return n;
+}
+
+/**
+ **
+ * @brief   fonctions de sortie : OLAT suit la copie locale, IODIR passe en
+ *          sortie une seule fois, une lecture de GPIO en un seul transfert
+ *
+ **/
+static void check_sorties(void){
+
+    expander_sim_t sim;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x27);
+    expander_t *exp = expander_initTransport(0x27, &expander_transport_sim, &sim);
+    expander_sim_chip_t *c = expander_sim_getChip(&sim, 0x27);
+
+    CHECK(exp != NULL);
+    if(exp == NULL)
+        return;
+
+    CHECK(expander_setPinGPIO(exp, PM_CS) == 0);
+    CHECK(c->reg[MCP23008_IODIR] == 0x00 && c->reg[REG_OLAT] == (1 << PM_CS));
+    CHECK(expander_togglePinGPIO(exp, PM_CS) == 0);
+    CHECK(c->reg[REG_OLAT] == 0x00);
+    CHECK(c->nb_write[MCP23008_IODIR] == 1);
+
+    CHECK(expander_setAllPinsGPIO(exp) == 0);
+    CHECK(c->reg[REG_OLAT] == 0xFF && exp->olat == 0xFF);
+
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_getAllPinsGPIO(exp) == 0xFF);
+    CHECK(sim.nb_xfer == 1);
+
+    expander_closeAndFree(exp);
+}
+
+/**
+ **
+ * @brief   expander_discover : un seul transfert avec I2C_M_IGNORE_NAK, une
+ *          lecture par adresse sans I2C_FUNC_PROTOCOL_MANGLING, registres tous egaux
+ *          ou IOCON.SEQOP reconnus, aucune interruption acquittée, autre
+ *          composant ecarté
+ *
+ **/
+static void check_discover(void){
+
+    expander_sim_t sim;
+    expander_t *found[8];
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x26);
+    expander_sim_addChip(&sim, 0x27);
+    expander_bus_t *bus = expander_bus_openTransport(&expander_transport_sim, &sim);
+
+    CHECK(expander_discover(bus, 0, found) == 0xC0);
+    CHECK(found[6] != NULL && found[7] != NULL && found[0] == NULL);
+
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_discover(bus, 0, NULL) == 0xC0);
+    CHECK(sim.nb_xfer == 1);                    // I2C_M_IGNORE_NAK : les absents lus a 0xFF
+
+    // sans I2C_FUNC_PROTOCOL_MANGLING : chaque adresse lue seule
+    bus->funcs &= ~I2C_FUNC_PROTOCOL_MANGLING;
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_discover(bus, 0, NULL) == 0xC0);
+    CHECK(sim.nb_xfer == 8);
+    bus->funcs |= I2C_FUNC_PROTOCOL_MANGLING;
+
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_discover(bus, 0xC0, NULL) == 0xC0);
+    CHECK(sim.nb_xfer == 1);
+
+    // IODIR = OLAT = GPIO = 0 : tous les registres lus a 0x00
+    CHECK(expander_resetAllPinsGPIO(found[7]) == 0);
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_discover(bus, 0xC0, NULL) == 0xC0);
+    CHECK(sim.nb_xfer == 2);                    // rafale + relecture de IOCON de 0x27
+
+    for(uint8_t a = 0x26; a <= 0x27; a++){
+
+        expander_sim_chip_t *c = expander_sim_getChip(&sim, a);
+        CHECK(c->nb_read[REG_INTF] == 0 && c->nb_read[REG_INTCAP] == 0 && c->nb_read[REG_GPIO] == 0);
+    }
+
+    expander_sim_getChip(&sim, 0x26)->reg[REG_IOCON] = IOCON_SEQOP;
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_discover(bus, 0xC0, NULL) == 0xC0);
+    CHECK(sim.nb_xfer == 3);                    // rafale + relecture de IOCON de 0x26 et 0x27
+
+    // bits inexistants de IOCON a 1 : ce n'est pas un MCP23008
+    expander_sim_getChip(&sim, 0x26)->reg[REG_IOCON] = 0x80;
+    CHECK(expander_discover(bus, 0, NULL) == 0x80);
+
+    expander_closeAndFree(found[6]);
+    expander_closeAndFree(found[7]);
+    expander_bus_close(bus);
+}
+
+/**
+ **
+ * @brief   expander_attach : aucune ecriture a l'attache ni pour une sortie
+ *          inchangée, pins en entree gardés, MCP au reset repris a froid
+ *
+ **/
+static void check_attach(void){
+
+    expander_sim_t sim;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x26);
+    expander_sim_addChip(&sim, 0x27);
+    expander_sim_chip_t *c = expander_sim_getChip(&sim, 0x27);
+    c->reg[MCP23008_IODIR] = 0x03;
+    c->reg[REG_GPPU] = 0x03;
+    c->reg[REG_OLAT] = 0xA0;
+    expander_bus_t *bus = expander_bus_openTransport(&expander_transport_sim, &sim);
+
+    expander_sim_resetCounters(&sim);
+    expander_t *exp = expander_attach(bus, 0x27);
+    CHECK(exp != NULL);
+    if(exp != NULL){
+
+        CHECK(sim.nb_xfer == 1 && nb_writes(&sim, 0x27) == 0);
+        CHECK(exp->iodir == 0x03 && exp->olat == 0xA0 && exp->inputs == 0x03);
+
+        CHECK(expander_setPullup(exp, 0x03) == 0 && expander_setPinGPIO(exp, 7) == 0);
+        CHECK(nb_writes(&sim, 0x27) == 0);
+
+        CHECK(expander_setPinGPIO(exp, 4) == 0);
+        CHECK(nb_writes(&sim, 0x27) == 1 && c->reg[REG_OLAT] == 0xB0 && c->reg[MCP23008_IODIR] == 0x03);
+        expander_closeAndFree(exp);
+    }
+
+    exp = expander_attach(bus, 0x26);
+    CHECK(exp != NULL && !exp->warm && exp->inputs == 0x00);
+    if(exp != NULL){
+
+        CHECK(expander_setPinGPIO(exp, 0) == 0);
+        CHECK(expander_sim_getChip(&sim, 0x26)->reg[MCP23008_IODIR] == 0x00);
+        expander_closeAndFree(exp);
+    }
+    expander_bus_close(bus);
+}
+
+/**
+ **
+ * @brief   interruption sur changement : INTF et INTCAP lus en un seul
+ *          transfert, INT relachée, pin d'interruption gardé en entree
+ *
+ **/
+static void check_irq(void){
+
+    expander_sim_t sim;
+    expander_event_t ev;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x26);
+    expander_t *exp = expander_initTransport(0x26, &expander_transport_sim, &sim);
+    expander_sim_chip_t *c = expander_sim_getChip(&sim, 0x26);
+
+    CHECK(exp != NULL);
+    if(exp == NULL)
+        return;
+
+    CHECK(expander_setInterrupt(exp, 1 << LOCK_D, 0x00, 0x00) == 0);
+    CHECK(expander_sim_getINT(&sim, 0x26) == 0);
+
+    expander_sim_setInputs(&sim, 0x26, 1 << LOCK_D);
+    CHECK(expander_sim_getINT(&sim, 0x26) == 1);
+
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_irq_service(exp, &ev, 1234) == 1);
+    CHECK(sim.nb_xfer == 1);
+    CHECK(ev.addr == 0x26 && ev.intf == (1 << LOCK_D) && (ev.intcap & (1 << LOCK_D)) && ev.timestamp_ns == 1234);
+    CHECK(expander_sim_getINT(&sim, 0x26) == 0);
+    CHECK(expander_irq_service(exp, &ev, 0) == 0 && ev.intf == 0);
+
+    CHECK(expander_setAllPinsGPIO(exp) == 0);
+    CHECK(c->reg[MCP23008_IODIR] == (1 << LOCK_D));
+
+    expander_closeAndFree(exp);
+}
+
+/**
+ **
+ * @brief   lot sur deux expanders : un seul transfert, copies locales a jour,
+ *          mesures de chaque expander, plus haute priorité, lot plein refusé
+ *
+ **/
+static void check_batch(void){
+
+    expander_sim_t sim;
+    expander_batch_t b;
+    uint8_t gpio26 = 0;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x26);
+    expander_sim_addChip(&sim, 0x27);
+    expander_t *exp26 = expander_initTransport(0x26, &expander_transport_sim, &sim);
+    expander_t *exp27 = expander_initTransport(0x27, &expander_transport_sim, &sim);
+
+    CHECK(exp26 != NULL && exp27 != NULL);
+    if(exp26 == NULL || exp27 == NULL)
+        return;
+
+    expander_sim_setInputs(&sim, 0x26, 0x5A);
+    expander_sim_resetCounters(&sim);
+    expander_resetStats(exp26);
+    expander_resetStats(exp27);
+    expander_bus_resetStats(exp26->bus);
+    CHECK(expander_setPriority(exp27, EXPANDER_PRIO_CRITICAL) == 0);
+
+    expander_batch_init(&b);
+    CHECK(expander_batch_write(&b, exp26, REG_GPPU, 0x0F) == 0);
+    CHECK(expander_batch_write(&b, exp27, REG_OLAT, 0xA5) == 0);
+    CHECK(expander_batch_read(&b, exp26, REG_GPIO, &gpio26) == 0);
+    CHECK(expander_batch_flush(&b) == 0);
+
+    CHECK(sim.nb_xfer == 1 && sim.nb_msg == 4);
+    CHECK(expander_sim_getChip(&sim, 0x26)->reg[REG_GPPU] == 0x0F && exp26->gppu == 0x0F);
+    CHECK(expander_sim_getChip(&sim, 0x27)->reg[REG_OLAT] == 0xA5 && exp27->olat == 0xA5);
+    CHECK(gpio26 == 0x5A);
+
+    // chaque expander compte ses messages, le lot part a la plus haute priorité
+    expander_stats_t st26, st27;
+    expander_bus_stats_t bst;
+    CHECK(expander_getStats(exp26, &st26) == 0 && expander_getStats(exp27, &st27) == 0);
+    CHECK(st26.nb_xfer == 1 && st26.nb_msgs == 3 && st27.nb_xfer == 1 && st27.nb_msgs == 1);
+    CHECK(expander_bus_getStats(exp26->bus, &bst) == 0);
+    CHECK(bst.prio_xfer[EXPANDER_PRIO_CRITICAL] == 1 && bst.prio_xfer[EXPANDER_PRIO_NORMAL] == 0);
+
+    int n = 0;
+    expander_batch_init(&b);
+    while(expander_batch_write(&b, exp27, REG_OLAT, 0x00) == 0)
+        n++;
+    CHECK(n == EXPANDER_BATCH_MAX_MSGS);
+    CHECK(expander_batch_read(&b, exp27, REG_GPIO, &gpio26) < 0);
+    expander_batch_init(&b);
+
+    expander_closeAndFree(exp26);
+    expander_closeAndFree(exp27);
+}
+
+/*
+ adaptateur i2c-dev simulé : les ioctl i2c de ce programme (I2C_FUNCS,
+ I2C_SLAVE, I2C_SMBUS, I2C_RDWR) sont servis par sim_i2cdev, quel que soit le
+ descripteur ; les autres vont au noyau. Le bus s'ouvre sur /dev/null
+*/
+static expander_sim_t *sim_i2cdev = NULL;
+static unsigned long funcs_i2cdev = 0;
+static int slave_i2cdev = -1;
+
+static int sim_i2cdev_xfer(struct i2c_msg *msgs, int nmsgs){
+
+    expander_bus_t b = { .tr_ctx = sim_i2cdev };
+
+    return expander_transport_sim.xfer(&b, msgs, nmsgs);
+}
+
+static int sim_i2cdev_smbus(struct i2c_smbus_ioctl_data *a){
+
+    uint8_t cmd[1 + I2C_SMBUS_BLOCK_MAX] = { a->command };
+    struct i2c_msg m[2] = {
+        { .addr = slave_i2cdev, .flags = 0, .len = 1, .buf = cmd },
+        { .addr = slave_i2cdev, .flags = I2C_M_RD, .len = 1, .buf = NULL },
+    };
+    unsigned long besoin;
+
+    switch(a->size){
+        case I2C_SMBUS_BYTE:            besoin = I2C_FUNC_SMBUS_BYTE; break;
+        case I2C_SMBUS_BYTE_DATA:       besoin = I2C_FUNC_SMBUS_BYTE_DATA; break;
+        case I2C_SMBUS_I2C_BLOCK_DATA:  besoin = I2C_FUNC_SMBUS_I2C_BLOCK; break;
+        default:                        besoin = ~0ul; break;
+    }
+    if(slave_i2cdev < 0 || (funcs_i2cdev & besoin) != besoin){
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    if(a->read_write == I2C_SMBUS_READ){
+
+        m[1].buf = a->size == I2C_SMBUS_I2C_BLOCK_DATA ? &a->data->block[1] : &a->data->byte;
+        m[1].len = a->size == I2C_SMBUS_I2C_BLOCK_DATA ? a->data->block[0] : 1;
+        if(a->size == I2C_SMBUS_BYTE)
+            return sim_i2cdev_xfer(&m[1], 1);
+        return sim_i2cdev_xfer(m, 2);
+    }
+    if(a->size == I2C_SMBUS_BYTE_DATA){
+        cmd[1] = a->data->byte;
+        m[0].len = 2;
+    }
+    else if(a->size == I2C_SMBUS_I2C_BLOCK_DATA){
+        memcpy(&cmd[1], &a->data->block[1], a->data->block[0]);
+        m[0].len = 1 + a->data->block[0];
+    }
+    return sim_i2cdev_xfer(m, 1);
+}
+
+int ioctl(int fd, unsigned long req, ...){
+
+    va_list ap;
+    void *arg = NULL;
+
+    va_start(ap, req);
+    if(req == I2C_SLAVE)
+        slave_i2cdev = va_arg(ap, int);
+    else
+        arg = va_arg(ap, void*);
+    va_end(ap);
+
+    switch(req){
+        case I2C_FUNCS:
+            *(unsigned long*)arg = funcs_i2cdev;
+            return 0;
+        case I2C_SLAVE:
+            return 0;
+        case I2C_SMBUS:
+            return sim_i2cdev_smbus(arg);
+        case I2C_RDWR:{
+            struct i2c_rdwr_ioctl_data *x = arg;
+            if(!(funcs_i2cdev & I2C_FUNC_I2C) || sim_i2cdev_xfer(x->msgs, x->nmsgs) < 0)
+                return -1;
+            return x->nmsgs;
+        }
+        default:
+            return syscall(SYS_ioctl, fd, req, arg);
+    }
+}
+
+/**
+ **
+ * @brief   methode d'acces choisie d'apres I2C_FUNCS ; par SMBus un ioctl par
+ *          registre, ou par rafale avec i2c-block, et recherche des expanders
+ *
+ **/
+static void check_methodes(void){
+
+    expander_sim_t sim;
+    expander_bus_t *bus;
+    uint8_t regs[3];
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x27);
+    expander_sim_chip_t *c = expander_sim_getChip(&sim, 0x27);
+    sim_i2cdev = &sim;
+
+    funcs_i2cdev = 0;
+    bus = expander_bus_open("/dev/null");
+    CHECK(bus != NULL && bus->method == EXPANDER_METHOD_RW);
+    CHECK(strcmp(expander_bus_methodName(bus), "read/write") == 0);
+    CHECK(expander_bus_setMethod(bus, EXPANDER_METHOD_SMBUS) != 0);
+    expander_bus_close(bus);
+
+    // I2C_RDWR des que l'adaptateur le sait : un ioctl par transfert
+    funcs_i2cdev = I2C_FUNC_I2C | I2C_FUNC_SMBUS_BYTE | I2C_FUNC_SMBUS_BYTE_DATA;
+    expander_t *exp = expander_initPath("/dev/null", 0x27);
+    CHECK(exp != NULL);
+    if(exp == NULL)
+        return;
+    CHECK(exp->bus->method == EXPANDER_METHOD_RDWR);
+    CHECK(expander_setPinGPIO(exp, PM_CS) == 0 && c->reg[REG_OLAT] == (1 << PM_CS));
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_readRegisters(exp, MCP23008_IODIR, regs, 3) == 0 && sim.nb_xfer == 1);
+    CHECK(regs[0] == 0x00);
+
+    // SMBus byte-data : un ioctl par registre
+    CHECK(expander_bus_setMethod(exp->bus, EXPANDER_METHOD_SMBUS) == 0);
+    CHECK(strcmp(expander_bus_methodName(exp->bus), "I2C_SMBUS") == 0);
+    expander_sim_setInputs(&sim, 0x27, 0x0F);
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_setPinGPIO(exp, T_CS) == 0 && c->reg[REG_OLAT] == ((1 << PM_CS) | (1 << T_CS)));
+    CHECK(sim.nb_xfer == 1);
+    expander_sim_resetCounters(&sim);
+    c->reg[MCP23008_IPOL] = 0x5A;
+    CHECK(expander_readRegisters(exp, MCP23008_IODIR, regs, 3) == 0 && sim.nb_xfer == 3);
+    CHECK(regs[0] == 0x00 && regs[1] == 0x5A);
+    CHECK(expander_getAllPinsGPIO(exp) == ((1 << PM_CS) | (1 << T_CS)));
+
+    // recherche par SMBus sans i2c-block : IODIR relu, pas l'octet suivant OLAT
+    expander_sim_resetCounters(&sim);
+    CHECK(expander_discover(exp->bus, 0, NULL) == 0x80);
+    CHECK(c->nb_read[MCP23008_IODIR] == 2);
+    expander_closeAndFree(exp);
+
+    // SMBus avec i2c-block : les rafales en un ioctl
+    funcs_i2cdev = I2C_FUNC_SMBUS_BYTE | I2C_FUNC_SMBUS_BYTE_DATA | I2C_FUNC_SMBUS_I2C_BLOCK;
+    bus = expander_bus_open("/dev/null");
+    CHECK(bus != NULL && bus->method == EXPANDER_METHOD_SMBUS);
+    CHECK(expander_bus_setMethod(bus, EXPANDER_METHOD_RDWR) != 0);
+    exp = expander_initBus(bus, 0x27);
+    CHECK(exp != NULL);
+    if(exp != NULL){
+
+        expander_sim_resetCounters(&sim);
+        CHECK(expander_readRegisters(exp, MCP23008_IODIR, regs, 3) == 0 && sim.nb_xfer == 1);
+        CHECK(regs[0] == 0x00 && regs[1] == 0x5A);
+        expander_closeAndFree(exp);
+    }
+    expander_bus_close(bus);
+    sim_i2cdev = NULL;
+}
+
+/**
+ **
+ * @brief   attend et recupere n fins d'operation sur as->fd (2 s au plus)
+ *
+ * @return  nombre de requetes rendues
+ *
+ **/
+static int reap_all(expander_async_t *as, expander_req_t **fin, int n){
+
+    struct pollfd pfd = { .fd = as->fd, .events = POLLIN };
+    int nb = 0;
+
+    while(nb < n && poll(&pfd, 1, 2000) == 1){
+
+        int r = expander_async_reap(as, fin + nb, n - nb);
+        if(r < 0)
+            break;
+        nb += r;
+    }
+    return nb;
+}
+
+/**
+ **
+ * @brief   file asynchrone : Er_Plein quand depth operations sont en vol, un
+ *          transfert par operation, fins rendues dans l'ordre par reap
+ *
+ **/
+static void check_async(void){
+
+    expander_sim_t sim;
+    expander_req_t r[5], *fin[5];
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x27);
+    expander_t *exp = expander_initTransport(0x27, &expander_transport_sim, &sim);
+    expander_async_t *as = expander_async_open(4);
+
+    CHECK(exp != NULL && as != NULL);
+    if(exp == NULL || as == NULL)
+        return;
+
+    expander_sim_setInputs(&sim, 0x27, 0x81);
+    expander_sim_resetCounters(&sim);
+
+    // le thread du bus reste bloqué sur le verrou de l'expander
+    pthread_mutex_lock(&exp->lock);
+    for(int i = 0; i < 4; i++){
+        expander_req_init(&r[i], EXPANDER_OP_READ_GPIO, exp, 0, 0);
+        CHECK(expander_async_submit(as, &r[i]) == 0);
+    }
+    expander_req_init(&r[4], EXPANDER_OP_SET_PIN, exp, 0, PM_CS);
+    CHECK(expander_async_submit(as, &r[4]) == Er_Plein);
+    pthread_mutex_unlock(&exp->lock);
+
+    CHECK(reap_all(as, fin, 4) == 4);
+    for(int i = 0; i < 4; i++)
+        CHECK(fin[i] == &r[i] && r[i].status == 0 && r[i].val == 0x81);
+    CHECK(sim.nb_xfer == 4);
+
+    CHECK(expander_async_submit(as, &r[4]) == 0);
+    CHECK(reap_all(as, fin, 1) == 1 && fin[0] == &r[4] && r[4].status == 0);
+    CHECK(expander_sim_getChip(&sim, 0x27)->reg[REG_OLAT] == (1 << PM_CS));
+
+    expander_async_close(as);
+    expander_closeAndFree(exp);
+}
+
+/**
+ **
+ * @brief   pool : un thread par bus, un bus bloqué n'empeche pas l'autre de
+ *          finir, toutes les fins arrivent sur pool->fd
+ *
+ **/
+static void check_pool(void){
+
+    expander_sim_t sim_a, sim_b;
+    expander_req_t ra[3], rb[2], *fin[4];
+    struct pollfd pfd;
+    int nb;
+
+    expander_sim_init(&sim_a, 0);
+    expander_sim_init(&sim_b, 0);
+    expander_sim_addChip(&sim_a, 0x26);
+    expander_sim_addChip(&sim_b, 0x27);
+    expander_t *a = expander_initTransport(0x26, &expander_transport_sim, &sim_a);
+    expander_t *b = expander_initTransport(0x27, &expander_transport_sim, &sim_b);
+    expander_pool_t *pool = expander_pool_open(2);
+
+    CHECK(a != NULL && b != NULL && pool != NULL && a->bus != b->bus);
+    if(a == NULL || b == NULL || pool == NULL)
+        return;
+
+    expander_sim_setInputs(&sim_a, 0x26, 0x5A);
+    expander_sim_setInputs(&sim_b, 0x27, 0xC3);
+    expander_sim_resetCounters(&sim_a);
+    expander_sim_resetCounters(&sim_b);
+    pfd = (struct pollfd){ .fd = pool->fd, .events = POLLIN };
+
+    // le thread du bus de a reste bloqué : sa file se remplit, b avance
+    pthread_mutex_lock(&a->lock);
+    for(int i = 0; i < 3; i++)
+        expander_req_init(&ra[i], EXPANDER_OP_READ_GPIO, a, 0, 0);
+    CHECK(expander_pool_submit(pool, &ra[0]) == 0);
+    CHECK(expander_pool_submit(pool, &ra[1]) == 0);
+    CHECK(expander_pool_submit(pool, &ra[2]) == Er_Plein);
+    for(int i = 0; i < 2; i++){
+        expander_req_init(&rb[i], EXPANDER_OP_READ_GPIO, b, 0, 0);
+        CHECK(expander_pool_submit(pool, &rb[i]) == 0);
+    }
+    CHECK(pool->nb_bus == 2);
+
+    nb = 0;
+    while(nb < 2 && poll(&pfd, 1, 2000) == 1)
+        nb += expander_pool_reap(pool, fin + nb, 4 - nb);
+    CHECK(nb == 2 && fin[0] == &rb[0] && fin[1] == &rb[1]);
+    CHECK(rb[0].status == 0 && rb[0].val == 0xC3 && sim_b.nb_xfer == 2);
+    CHECK(sim_a.nb_xfer == 0);
+    pthread_mutex_unlock(&a->lock);
+
+    nb = 0;
+    while(nb < 2 && poll(&pfd, 1, 2000) == 1)
+        nb += expander_pool_reap(pool, fin + nb, 4 - nb);
+    CHECK(nb == 2 && fin[0] == &ra[0] && fin[1] == &ra[1]);
+    CHECK(ra[1].status == 0 && ra[1].val == 0x5A && sim_a.nb_xfer == 2);
+
+    expander_pool_close(pool);
+    expander_closeAndFree(a);
+    expander_closeAndFree(b);
+}
+
+/**
+ **
+ * @brief   EXPANDER_VERIFY_NONE : une seule ecriture de OLAT sans relecture.
+ *          EXPANDER_VERIFY_SCRUB : le thread du bus repare IODIR et OLAT
+ *
+ **/
+static void check_scrub(void){
+
+    expander_sim_t sim;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x27);
+    expander_bus_t *bus = expander_bus_openTransport(&expander_transport_sim, &sim);
+    expander_t *exp = expander_initBus(bus, 0x27);
+    expander_sim_chip_t *c = expander_sim_getChip(&sim, 0x27);
+
+    CHECK(exp != NULL);
+    if(exp != NULL){
+
+        CHECK(expander_setPinGPIO(exp, PM_CS) == 0);
+        expander_sim_resetCounters(&sim);
+        CHECK(expander_setPinGPIO(exp, T_CS) == 0);
+        CHECK(sim.nb_xfer == 1 && c->nb_write[REG_OLAT] == 1 && c->nb_read[REG_GPIO] == 0);
+        CHECK(expander_bus_setScrubPeriod(bus, 10) == 0);
+
+        // chute d'alimentation : le MCP revient a ses valeurs du reset
+        pthread_mutex_lock(&bus->lock);
+        c->reg[MCP23008_IODIR] = 0xFF;
+        c->reg[REG_OLAT] = 0x00;
+        pthread_mutex_unlock(&bus->lock);
+
+        CHECK(expander_setVerify(exp, EXPANDER_VERIFY_SCRUB) == 0);
+        usleep(50000);
+
+        pthread_mutex_lock(&bus->lock);
+        CHECK(c->reg[MCP23008_IODIR] == 0x00 && c->reg[REG_OLAT] == ((1 << PM_CS) | (1 << T_CS)));
+        pthread_mutex_unlock(&bus->lock);
+
+        expander_bus_stats_t st;
+        CHECK(expander_bus_getStats(bus, &st) == 0 && st.prio_xfer[EXPANDER_PRIO_BACKGROUND] > 0);
+        expander_closeAndFree(exp);
+    }
+    expander_bus_close(bus);
+}
+
+/**
+ **
+ * @brief   echantillonneur : une lecture par echantillon pour deux expanders du
+ *          meme bus, readChanges ne rend que les changements
+ *
+ **/
+static void check_sampler(void){
+
+    expander_sim_t sim;
+    expander_sample_t ech[64];
+    expander_sampler_cursor_t cur;
+    expander_sampler_stats_t st;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x26);
+    expander_sim_addChip(&sim, 0x27);
+    expander_bus_t *bus = expander_bus_openTransport(&expander_transport_sim, &sim);
+    expander_t *exps[2] = { expander_initBus(bus, 0x26), expander_initBus(bus, 0x27) };
+
+    CHECK(exps[0] != NULL && exps[1] != NULL);
+    if(exps[0] != NULL && exps[1] != NULL){
+
+        expander_sim_setInputs(&sim, 0x26, 0x0F);
+        expander_sim_setInputs(&sim, 0x27, 0xF0);
+        expander_sim_resetCounters(&sim);
+
+        expander_sampler_t *s = expander_sampler_open(exps, 2, 1000, 4096);
+        CHECK(s != NULL);
+        if(s != NULL){
+
+            expander_sampler_cursor(s, &cur, 0);
+            usleep(20000);
+            pthread_mutex_lock(&bus->lock);
+            expander_sim_setInputs(&sim, 0x26, 0x55);
+            pthread_mutex_unlock(&bus->lock);
+            usleep(20000);
+            pthread_mutex_lock(&bus->lock);
+            expander_sim_setInputs(&sim, 0x27, 0xAA);
+            pthread_mutex_unlock(&bus->lock);
+            usleep(20000);
+
+            int n = expander_sampler_readChanges(s, &cur, ech, 64);
+            CHECK(n == 3);
+            if(n == 3){
+
+                CHECK(ech[0].gpio[0] == 0x0F && ech[0].gpio[1] == 0xF0);
+                CHECK(ech[1].gpio[0] == 0x55 && ech[1].gpio[1] == 0xF0);
+                CHECK(ech[2].gpio[0] == 0x55 && ech[2].gpio[1] == 0xAA);
+                CHECK(ech[0].timestamp_ns < ech[1].timestamp_ns && ech[1].timestamp_ns < ech[2].timestamp_ns);
+            }
+            CHECK(cur.nb_lost == 0);
+
+            expander_sampler_getStats(s, &st);
+            expander_sampler_close(s);
+            CHECK(st.nb_samples >= 30 && st.nb_errors == 0);
+            // un transfert par echantillon, au plus un de plus pris avant l'arret
+            CHECK(sim.nb_xfer >= st.nb_samples && sim.nb_xfer <= st.nb_samples + 1);
+            CHECK(sim.nb_msg == 4 * sim.nb_xfer);
+        }
+    }
+    expander_closeAndFree(exps[0]);
+    expander_closeAndFree(exps[1]);
+    expander_bus_close(bus);
+}
+
+/**
+ **
+ * @brief   anti-rebond : compteurs verticaux comparés pin par pin a un modele
+ *          scalaire sur une entree aleatoire, seuils differents par pin
+ *
+ **/
+static void check_debounce(void){
+
+    expander_debounce_t d;
+    uint8_t stable[64], cnt[64] = { 0 };
+    uint64_t ref, raw = 0x0123456789ABCDEFull, alea = 88172645463325252ull;
+    int ecarts = 0, bascules = 0;
+
+    expander_debounce_init(&d, raw, 3);
+    ref = raw;
+    for(int chip = 0; chip < EXPANDER_DEBOUNCE_NB_EXP; chip++)
+        for(int p = 0; p < 8; p++){
+
+            stable[8 * chip + p] = 1 + (chip * 8 + p * 5) % EXPANDER_DEBOUNCE_MAX;
+            CHECK(expander_debounce_setStable(&d, chip, 1 << p, stable[8 * chip + p]) == 0);
+        }
+    CHECK(expander_debounce_setStable(&d, 0, 0x01, 0) != 0);
+    CHECK(expander_debounce_setStable(&d, 8, 0x01, 3) != 0);
+
+    for(int n = 0; n < 20000; n++){
+
+        // chaque pin bascule avec une probabilité 1/8 : rebonds et paliers
+        uint64_t flip = ~0ull;
+        for(int k = 0; k < 3; k++){
+
+            alea ^= alea << 13;
+            alea ^= alea >> 7;
+            alea ^= alea << 17;
+            flip &= alea;
+        }
+        raw ^= flip;
+
+        uint64_t attendu = 0;
+        for(int b = 0; b < 64; b++){
+
+            if(((raw ^ ref) >> b & 1) == 0)
+                cnt[b] = 0;
+            else if(++cnt[b] == stable[b]){
+
+                attendu |= 1ull << b;
+                cnt[b] = 0;
+            }
+        }
+        ref ^= attendu;
+
+        uint64_t change;
+        if(n & 1){
+
+            uint8_t gpio[EXPANDER_DEBOUNCE_NB_EXP];
+            for(int i = 0; i < EXPANDER_DEBOUNCE_NB_EXP; i++)
+                gpio[i] = raw >> (8 * i);
+            change = expander_debounce_feedBytes(&d, gpio, EXPANDER_DEBOUNCE_NB_EXP);
+        }
+        else
+            change = expander_debounce_feed(&d, raw);
+
+        if(change != attendu || d.state != ref)
+            ecarts++;
+        bascules += __builtin_popcountll(attendu);
+    }
+    CHECK(ecarts == 0 && bascules > 10000);
+    CHECK(expander_debounce_get(&d, 3) == (uint8_t)(ref >> 24));
+}
+
+typedef struct sched_arg
+{
+    expander_bus_t *bus;
+    expander_prio_t prio;
+    uint8_t msg[2];
+    pthread_t th;
+
+}sched_arg_t;
+
+static void* sched_writer(void *arg){
+
+    sched_arg_t *a = arg;
+    struct i2c_msg m = { .addr = 0x27, .flags = 0, .len = 2, .buf = a->msg };
+
+    expander_bus_transferPrio(a->bus, &m, 1, a->prio);
+    return NULL;
+}
+
+/**
+ **
+ * @brief   bloque le bus, met n ecritures de OLAT en file (dans l'ordre, 20 ms
+ *          d'ecart), libere le bus et rend les valeurs ecrites dans l'ordre
+ *          du bus
+ *
+ * @return  nombre de transferts relus dans la trace
+ *
+ **/
+static int sched_run(expander_bus_t *bus, const expander_prio_t *prio, int n, uint8_t *ordre){
+
+    sched_arg_t a[16];
+    expander_trace_entry_t e[17];
+
+    expander_bus_trace(bus, NULL, 32);
+    pthread_mutex_lock(&bus->lock);
+    for(int i = 0; i <= n; i++){
+
+        // le premier prend le bus et reste bloqué sur son verrou
+        a[i] = (sched_arg_t){ .bus = bus, .prio = i ? prio[i - 1] : EXPANDER_PRIO_NORMAL,
+                              .msg = { REG_OLAT, i } };
+        pthread_create(&a[i].th, NULL, sched_writer, &a[i]);
+        usleep(20000);
+    }
+    pthread_mutex_unlock(&bus->lock);
+    for(int i = 0; i <= n; i++)
+        pthread_join(a[i].th, NULL);
+
+    int nb = expander_trace_snapshot(bus->trace, e, 17);
+    for(int i = 1; i < nb; i++)
+        ordre[i - 1] = e[i].val;
+    expander_bus_trace(bus, NULL, 0);
+    return nb - 1;
+}
+
+/**
+ **
+ * @brief   ordonnanceur : le plus prioritaire en attente passe d'abord, le plus
+ *          ancien a priorité egale, et un transfert qui a laissé passer
+ *          EXPANDER_SCHED_BUDGET_US de temps de bus passe en tete
+ *
+ **/
+static void check_sched(void){
+
+    expander_sim_t sim;
+    expander_bus_stats_t st;
+    uint8_t ordre[16];
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x27);
+    expander_bus_t *bus = expander_bus_openTransport(&expander_transport_sim, &sim);
+    expander_t *exp = expander_initBus(bus, 0x27);
+
+    CHECK(exp != NULL);
+    if(exp == NULL){
+        expander_bus_close(bus);
+        return;
+    }
+
+    const expander_prio_t p1[] = { EXPANDER_PRIO_BACKGROUND, EXPANDER_PRIO_NORMAL, EXPANDER_PRIO_CRITICAL,
+                                   EXPANDER_PRIO_HIGH, EXPANDER_PRIO_NORMAL };
+    CHECK(sched_run(bus, p1, 5, ordre) == 5);
+    CHECK(ordre[0] == 3 && ordre[1] == 4 && ordre[2] == 2 && ordre[3] == 5 && ordre[4] == 1);
+
+    // 100 kHz : 290 us par ecriture, le fond passe apres 7 transferts devant lui
+    const expander_prio_t p2[] = { EXPANDER_PRIO_BACKGROUND, EXPANDER_PRIO_HIGH, EXPANDER_PRIO_HIGH,
+                                   EXPANDER_PRIO_HIGH, EXPANDER_PRIO_HIGH, EXPANDER_PRIO_HIGH,
+                                   EXPANDER_PRIO_HIGH, EXPANDER_PRIO_HIGH, EXPANDER_PRIO_HIGH,
+                                   EXPANDER_PRIO_HIGH };
+    CHECK(expander_bus_setClock(bus, 100000) == 0);
+    CHECK(sched_run(bus, p2, 10, ordre) == 10);
+    CHECK(ordre[0] == 2 && ordre[6] == 8 && ordre[7] == 1 && ordre[8] == 9 && ordre[9] == 10);
+
+    // priorité de l'expander, du thread, et affichage toujours en fond
+    CHECK(expander_setPinGPIO(exp, PM_CS) == 0);
+    expander_bus_resetStats(bus);
+    CHECK(expander_setPriority(exp, EXPANDER_PRIO_CRITICAL) == 0);
+    CHECK(expander_setPriority(exp, EXPANDER_NB_PRIO) != 0);
+    CHECK(expander_togglePinGPIO(exp, PM_CS) == 0);
+    expander_setThreadPriority(EXPANDER_PRIO_HIGH);
+    CHECK(expander_resetPinGPIO(exp, PM_CS) == 0);
+    expander_setThreadPriority(-1);
+    fflush(stdout);
+    int sortie = dup(STDOUT_FILENO), nul = open("/dev/null", O_WRONLY);
+    dup2(nul, STDOUT_FILENO);
+    CHECK(expander_printGPIO(exp) == 0);
+    fflush(stdout);
+    dup2(sortie, STDOUT_FILENO);
+    close(sortie);
+    close(nul);
+    expander_bus_getStats(bus, &st);
+    CHECK(st.prio_xfer[EXPANDER_PRIO_CRITICAL] == 1 && st.prio_xfer[EXPANDER_PRIO_HIGH] == 1);
+    CHECK(st.prio_xfer[EXPANDER_PRIO_BACKGROUND] == 1 && st.prio_xfer[EXPANDER_PRIO_NORMAL] == 0);
+
+    expander_closeAndFree(exp);
+    expander_bus_close(bus);
+}
+
+static void* inherit_lecteur(void *arg){
+
+    expander_getAllPinsGPIO(arg);
+    return NULL;
+}
+
+static void* inherit_critique(void *arg){
+
+    expander_setThreadPriority(EXPANDER_PRIO_CRITICAL);
+    expander_togglePinGPIO(arg, RCD_DIS);
+    return NULL;
+}
+
+/**
+ **
+ * @brief   heritage de priorité : une lecture de fond en file qui tient le
+ *          verrou de 0x26 passe devant les ecritures normales quand une
+ *          ecriture critique attend ce verrou, au compte de la priorité
+ *          critique, et celle-ci n'attend pas toutes les ecritures normales
+ *
+ **/
+static void check_inherit(void){
+
+    expander_sim_t sim;
+    expander_trace_entry_t e[8];
+    expander_bus_stats_t st;
+    sched_arg_t a[5];
+    pthread_t lecteur, critique;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x26);
+    expander_sim_addChip(&sim, 0x27);
+    expander_bus_t *bus = expander_bus_openTransport(&expander_transport_sim, &sim);
+    expander_t *exp = expander_initBus(bus, 0x26);
+
+    CHECK(exp != NULL);
+    if(exp == NULL){
+        expander_bus_close(bus);
+        return;
+    }
+    CHECK(expander_setPinGPIO(exp, RCD_DIS) == 0);
+    CHECK(expander_setPriority(exp, EXPANDER_PRIO_BACKGROUND) == 0);
+
+    expander_bus_resetStats(bus);
+    expander_bus_trace(bus, NULL, 16);
+    pthread_mutex_lock(&bus->lock);
+    for(int i = 0; i < 5; i++){
+
+        a[i] = (sched_arg_t){ .bus = bus, .prio = EXPANDER_PRIO_NORMAL, .msg = { REG_OLAT, i } };
+        pthread_create(&a[i].th, NULL, sched_writer, &a[i]);
+        usleep(20000);
+        // derriere le premier (qui a le bus) : la lecture de fond, puis 4 ecritures
+        if(i == 0){
+            pthread_create(&lecteur, NULL, inherit_lecteur, exp);
+            usleep(20000);
+        }
+    }
+    pthread_create(&critique, NULL, inherit_critique, exp);
+    usleep(20000);
+    pthread_mutex_unlock(&bus->lock);
+
+    for(int i = 0; i < 5; i++)
+        pthread_join(a[i].th, NULL);
+    pthread_join(lecteur, NULL);
+    pthread_join(critique, NULL);
+
+    CHECK(expander_trace_snapshot(bus->trace, e, 8) == 7);
+    CHECK(e[0].addr == 0x27 && e[0].val == 0);
+    CHECK(e[1].addr == 0x26 && e[1].reg == REG_GPIO);
+
+    // le bus est deja rendu aux ecritures normales quand l'ecriture critique
+    // se met en file : elle passe apres celle en cours, pas apres toutes
+    int ic = 2, n = 1;
+    while(ic < 7 && e[ic].addr != 0x26)
+        ic++;
+    CHECK(ic >= 3 && ic < 6 && e[ic].reg == REG_OLAT && e[ic].val == 0x00);
+    for(int i = 2; i < 7; i++)
+        if(i != ic)
+            CHECK(e[i].addr == 0x27 && e[i].val == n++);
+
+    expander_bus_getStats(bus, &st);
+    CHECK(st.prio_xfer[EXPANDER_PRIO_CRITICAL] == 2 && st.prio_xfer[EXPANDER_PRIO_BACKGROUND] == 0);
+    expander_bus_trace(bus, NULL, 0);
+
+    expander_closeAndFree(exp);
+    expander_bus_close(bus);
+}
+
+/**
+ **
+ * @brief   relit un fichier de trace comme expander_trace_dump
+ *
+ * @return  la trace (a liberer avec free), NULL si echec
+ *
+ **/
+static expander_trace_t* trace_load(const char *file){
+
+    FILE *f = fopen(file, "rb");
+    expander_trace_t *tr = NULL;
+    long taille;
+
+    if(f == NULL)
+        return NULL;
+    if(fseek(f, 0, SEEK_END) == 0 && (taille = ftell(f)) >= (long)sizeof(expander_trace_t)){
+
+        tr = malloc(taille);
+        rewind(f);
+        if(tr != NULL && fread(tr, taille, 1, f) != 1){
+            free(tr);
+            tr = NULL;
+        }
+    }
+    fclose(f);
+    return tr;
+}
+
+/**
+ **
+ * @brief   trace du bus : une entree par selection + lecture, ecritures et
+ *          NACK notés, copie sur fichier relue et decodée a l'identique
+ *
+ **/
+static void check_trace(void){
+
+    expander_sim_t sim;
+    expander_trace_entry_t e[8], relu[8];
+    uint8_t val, reg = REG_GPIO;
+    char fichier[64], *texte = NULL;
+    size_t taille = 0;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x27);
+    expander_bus_t *bus = expander_bus_openTransport(&expander_transport_sim, &sim);
+    expander_t *exp = expander_initBus(bus, 0x27);
+
+    CHECK(exp != NULL && bus->trace != NULL);
+    if(exp == NULL || bus->trace == NULL){
+        expander_closeAndFree(exp);
+        expander_bus_close(bus);
+        return;
+    }
+
+    CHECK(expander_bus_trace(bus, NULL, 8) == 0);
+    CHECK(expander_writeRegister(exp, REG_OLAT, 0x20) == 0);
+    CHECK(expander_readRegister(exp, REG_OLAT, &val) == 0 && val == 0x20);
+
+    // 0x20 absent : NACK
+    struct i2c_msg msgs[2] = {
+        { .addr = 0x20, .flags = 0, .len = 1, .buf = &reg },
+        { .addr = 0x20, .flags = I2C_M_RD, .len = 1, .buf = &val },
+    };
+    CHECK(expander_bus_transfer(bus, msgs, 2) < 0);
+
+    int n = expander_trace_snapshot(bus->trace, e, 8);
+    CHECK(n == 3);
+    if(n == 3){
+
+        CHECK(e[0].addr == 0x27 && e[0].reg == REG_OLAT && e[0].val == 0x20
+              && e[0].flags == (EXPANDER_TRACE_FIRST | (1 << 4)));
+        CHECK(e[1].addr == 0x27 && e[1].reg == REG_OLAT && e[1].val == 0x20
+              && e[1].flags == (EXPANDER_TRACE_FIRST | EXPANDER_TRACE_READ | (1 << 4)));
+        CHECK(e[2].addr == 0x20 && e[2].reg == REG_GPIO
+              && (e[2].flags & (EXPANDER_TRACE_ERR | EXPANDER_TRACE_READ)) == (EXPANDER_TRACE_ERR | EXPANDER_TRACE_READ));
+    }
+
+    snprintf(fichier, sizeof(fichier), "/tmp/expander_check.%d.trace", (int)getpid());
+    CHECK(expander_trace_save(bus->trace, fichier) == 0);
+
+    expander_trace_t *tr = trace_load(fichier);
+    CHECK(tr != NULL);
+    if(tr != NULL){
+
+        CHECK(expander_trace_snapshot(tr, relu, 8) == n && memcmp(relu, e, n * sizeof(e[0])) == 0);
+
+        FILE *out = open_memstream(&texte, &taille);
+        CHECK(expander_trace_print(tr, out, 0) == n);
+        fclose(out);
+        CHECK(texte != NULL && strstr(texte, "0x27 W OLAT    0x20  1 ok") != NULL);
+        CHECK(texte != NULL && strstr(texte, "0x27 R OLAT    0x20  1 ok") != NULL);
+        CHECK(texte != NULL && strstr(texte, "0x20 R GPIO") != NULL && strstr(texte, "ERREUR") != NULL);
+        free(texte);
+        free(tr);
+    }
+    unlink(fichier);
+
+    expander_closeAndFree(exp);
+    expander_bus_close(bus);
+}
+
+static const struct {
+    const char *nom;
+    void (*fn)(void);
+} checks[] = {
+    { "sorties",        check_sorties },
+    { "discover",       check_discover },
+    { "attach",         check_attach },
+    { "irq",            check_irq },
+    { "batch",          check_batch },
+    { "async",          check_async },
+    { "scrub",          check_scrub },
+    { "trace",          check_trace },
+    { "sampler",        check_sampler },
+    { "debounce",       check_debounce },
+    { "pool",           check_pool },
+    { "methodes",       check_methodes },
+    { "sched",          check_sched },
+    { "inherit",        check_inherit },
+};
+
+int main(void){
+
+    for(size_t k = 0; k < sizeof(checks) / sizeof(checks[0]); k++){
+
+        int avant = nb_echecs;
+        checks[k].fn();
+        printf("%-12s %s\n", checks[k].nom, nb_echecs == avant ? "ok" : "ECHEC");
+    }
+    return nb_echecs ? EXIT_FAILURE : EXIT_SUCCESS;
+}
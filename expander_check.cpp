@@ -0,0 +1,150 @@
+/**
+ * @file expander_check.cpp
+ * @author Hamza RAHAL
+ * @brief  verifications de non regression des en-tetes C++ sur des MCP23008
+ *         simulés : ce qui ne doit pas compiler est verifié a la compilation,
+ *         les ecritures a l'execution. Sort en echec si l'une rate
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * usage : expander_check_cpp
+ *
+ * Licence Libre
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include "expander.hpp"
+#include "expander_sim.h"
+
+using namespace mcp::board;
+
+static int nb_echecs = 0;
+
+#define CHECK(cond) do{                                                         \
+        if(!(cond)){                                                            \
+            std::printf("    ECHEC ligne %d : %s\n", __LINE__, #cond);          \
+            nb_echecs++;                                                        \
+        }                                                                       \
+    }while(0)
+
+/*
+ vrai si p.set(m) compile
+*/
+template<class P, class M, class = void>
+struct can_set : std::false_type {};
+
+template<class P, class M>
+struct can_set<P, M, std::void_t<decltype(std::declval<const P&>().set(std::declval<M>()))>> : std::true_type {};
+
+static_assert(decltype(all_cs)::mask == 0x3C, "all_cs : PM_CS, T_CS, CP_CS et PP_CS");
+static_assert(decltype(led_dis | pm0)::mask == 0x81, "masque calculé a la compilation");
+static_assert(can_set<mcp::Port<Exp27>, decltype(pm_cs)>::value, "pin de 0x27 sur 0x27");
+static_assert(!can_set<mcp::Port<Exp27>, decltype(lock_d)>::value, "pin de 0x26 refusé sur 0x27");
+static_assert(!can_set<mcp::Port<Exp26>, decltype(all_cs)>::value, "masque de 0x27 refusé sur 0x26");
+
+/**
+ **
+ * @brief   mcp::Port : une ecriture de OLAT par appel, masques constants
+ *
+ **/
+static void check_port(void){
+
+    expander_sim_t sim;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x27);
+    expander_t *exp27 = expander_initTransport(0x27, &expander_transport_sim, &sim);
+    expander_sim_chip_t *c = expander_sim_getChip(&sim, 0x27);
+
+    CHECK(exp27 != nullptr);
+    if(exp27 == nullptr)
+        return;
+
+    mcp::Port<Exp27> p27(exp27);
+
+    CHECK(p27.set(all_cs) == 0);
+    CHECK(c->reg[REG_OLAT] == 0x3C && c->reg[MCP23008_IODIR] == 0x00);
+
+    expander_sim_resetCounters(&sim);
+    CHECK(p27.write(led_dis | pm0, pm_cs) == 0);
+    CHECK(sim.nb_xfer == 1 && c->reg[REG_OLAT] == 0x9D);
+    CHECK(p27.toggle(t_cs) == 0 && c->reg[REG_OLAT] == 0x8D);
+    CHECK(p27.clear(led_dis) == 0 && c->reg[REG_OLAT] == 0x8C);
+    CHECK(p27.only(pm1) == 0 && c->reg[REG_OLAT] == 0x40);
+    CHECK(p27.get(pm1) && !p27.get(pm0) && p27.read(all_cs | pm1) == 0x40);
+
+    expander_closeAndFree(exp27);
+}
+
+/**
+ **
+ * @brief   mcp::Bus et mcp::Expander : references sur le bus suivies par les
+ *          deplacements, mcp::update sur deux expanders en un seul transfert
+ *
+ **/
+static void check_classes(void){
+
+    expander_sim_t sim;
+
+    expander_sim_init(&sim, 0);
+    expander_sim_addChip(&sim, 0x26);
+    expander_sim_addChip(&sim, 0x27);
+    expander_sim_chip_t *c26 = expander_sim_getChip(&sim, 0x26);
+    expander_sim_chip_t *c27 = expander_sim_getChip(&sim, 0x27);
+
+    mcp::Bus bus(&expander_transport_sim, &sim);
+    CHECK(bus && bus.get()->refcount == 1);
+    if(!bus)
+        return;
+
+    mcp::Expander exp26(bus, 0x26), exp27(bus, 0x27);
+    CHECK(exp26 && exp27 && bus.get()->refcount == 3);
+
+    {
+        mcp::Expander tmp(std::move(exp27));
+        CHECK(!exp27 && tmp && bus.get()->refcount == 3);
+        exp27 = std::move(tmp);
+    }
+    CHECK(exp27 && bus.get()->refcount == 3);
+
+    CHECK(exp26.set(LOCK_D) == 0 && exp27.set(LED_DIS) == 0);
+    CHECK(c26->reg[REG_OLAT] == (1 << LOCK_D) && c27->reg[REG_OLAT] == (1 << LED_DIS));
+
+    expander_sim_resetCounters(&sim);
+    auto p27 = exp27.port<Exp27>();
+    CHECK(mcp::update({ { exp26, 1 << RCD_DIS, 1 << LOCK_D },
+                        { p27, all_cs, led_dis },
+                        { exp26, 1 << RCD_TST, 0 } }) == 0);
+    CHECK(sim.nb_xfer == 1);
+    CHECK(c26->reg[REG_OLAT] == ((1 << RCD_DIS) | (1 << RCD_TST)));
+    CHECK(c27->reg[REG_OLAT] == 0x3C && exp27.get()->olat == 0x3C);
+
+    {
+        mcp::Bus autre(std::move(bus));
+        CHECK(!bus && autre.get()->refcount == 3);
+    }
+    CHECK(exp26.get()->bus->refcount == 2);
+    CHECK(exp26.toggle(RCD_DIS) == 0 && c26->reg[REG_OLAT] == (1 << RCD_TST));
+}
+
+static const struct {
+    const char *nom;
+    void (*fn)(void);
+} checks[] = {
+    { "port",           check_port },
+    { "classes",        check_classes },
+};
+
+int main(void){
+
+    for(const auto &k : checks){
+
+        int avant = nb_echecs;
+        k.fn();
+        std::printf("%-12s %s\n", k.nom, nb_echecs == avant ? "ok" : "ECHEC");
+    }
+    return nb_echecs ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file expander_debounce.c
+ * @author Hamza RAHAL
+ * @brief  anti-rebond par compteurs verticaux : le compteur de chaque pin est
+ *         reparti sur EXPANDER_DEBOUNCE_BITS mots, les 64 pins avancent ensemble
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include "expander_debounce.h"
+
+
+/**
+ **
+ * @brief   remet le filtre a zero
+ *
+ * @param   d filtre
+ * @param   initial etat de depart (ex: premiere lecture des GPIO)
+ * @param   stable echantillons stables exigés pour tous les pins (1 a 15)
+ *
+ **/
+void expander_debounce_init(expander_debounce_t *d, uint64_t initial, unsigned int stable){
+
+    memset(d, 0, sizeof(*d));
+    d->state = initial;
+    for(int chip = 0; chip < EXPANDER_DEBOUNCE_NB_EXP; chip++)
+        expander_debounce_setStable(d, chip, 0xFF, stable);
+}
+
+/**
+ **
+ * @brief   change le nombre d'echantillons stables exigés pour des pins
+ *
+ * @param   d filtre
+ * @param   chip octet de l'expander dans le mot (0 a 7)
+ * @param   pins pins concernés
+ * @param   stable echantillons (1 a 15, 1 : pas de filtrage)
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_debounce_setStable(expander_debounce_t *d, int chip, uint8_t pins, unsigned int stable){
+
+    if(d == NULL || chip < 0 || chip >= EXPANDER_DEBOUNCE_NB_EXP
+       || stable == 0 || stable > EXPANDER_DEBOUNCE_MAX)
+        return Er_Expander_Ecriture;
+
+    uint64_t m = (uint64_t)pins << (8 * chip);
+
+    for(int k = 0; k < EXPANDER_DEBOUNCE_BITS; k++){
+
+        d->thr[k] &= ~m;
+        if(stable & (1u << k))
+            d->thr[k] |= m;
+        d->cnt[k] &= ~m;
+    }
+    return 0;
+}
+
+/**
+ **
+ * @brief   passe un echantillon dans le filtre
+ *
+ * @param   d filtre
+ * @param   raw GPIO lus, octet i = expander i
+ *
+ * @return  pins dont l'etat filtré vient de changer
+ *
+ **/
+uint64_t expander_debounce_feed(expander_debounce_t *d, uint64_t raw){
+
+    uint64_t diff = raw ^ d->state;
+    uint64_t carry = diff;
+    uint64_t eq = ~0ull;
+
+    // +1 sur les pins differents de l'etat filtré, remise a zero des autres
+    for(int k = 0; k < EXPANDER_DEBOUNCE_BITS; k++){
+
+        uint64_t c = d->cnt[k];
+        d->cnt[k] = (c ^ carry) & diff;
+        carry &= c;
+        eq &= ~(d->cnt[k] ^ d->thr[k]);
+    }
+
+    // seuil atteint : le pin bascule et son compteur repart de zero
+    uint64_t change = eq & diff;
+    d->state ^= change;
+    for(int k = 0; k < EXPANDER_DEBOUNCE_BITS; k++)
+        d->cnt[k] &= ~change;
+    return change;
+}
+
+/**
+ **
+ * @brief   passe un echantillon donné octet par octet (ex: expander_sample_t.gpio)
+ *
+ * @param   d filtre
+ * @param   gpio GPIO lus, gpio[i] = expander i
+ * @param   n nombre d'octets (1 a 8)
+ *
+ * @return  pins dont l'etat filtré vient de changer
+ *
+ **/
+uint64_t expander_debounce_feedBytes(expander_debounce_t *d, const uint8_t *gpio, int n){
+
+    uint64_t raw = d->state;
+
+    if(n > EXPANDER_DEBOUNCE_NB_EXP)
+        n = EXPANDER_DEBOUNCE_NB_EXP;
+    for(int i = 0; i < n; i++){
+        raw &= ~(0xFFull << (8 * i));
+        raw |= (uint64_t)gpio[i] << (8 * i);
+    }
+    return expander_debounce_feed(d, raw);
+}
+
+/**
+ **
+ * @brief   etat filtré des pins d'un expander
+ *
+ **/
+uint8_t expander_debounce_get(const expander_debounce_t *d, int chip){
+
+    if(d == NULL || chip < 0 || chip >= EXPANDER_DEBOUNCE_NB_EXP)
+        return 0;
+    return d->state >> (8 * chip);
+}
@@ -0,0 +1,52 @@
+#ifndef _EXPANDER_DEBOUNCE_H
+#define _EXPANDER_DEBOUNCE_H
+
+/**
+ * @file expander_debounce.h
+ * @author Hamza RAHAL
+ * @brief  anti-rebond et filtre d'impulsions sur les entrees : compteurs
+ *         verticaux sur un mot de 64 bits, soit les 8 pins de 8 expanders
+ *         filtrés ensemble en quelques operations logiques par echantillon
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include "MCP23017.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EXPANDER_DEBOUNCE_NB_EXP    8       // un octet par expander dans le mot
+#define EXPANDER_DEBOUNCE_BITS      4       // compteurs de 4 bits
+#define EXPANDER_DEBOUNCE_MAX       15      // echantillons stables au plus
+
+/*
+ bit 8*i+p = pin p de l'expander i. Un pin ne change d'etat qu'apres stable[pin]
+ echantillons consecutifs differents de son etat filtré : les impulsions plus
+ courtes sont ignorées
+*/
+typedef struct expander_debounce
+{
+    uint64_t state;                         // etat filtré
+    uint64_t cnt[EXPANDER_DEBOUNCE_BITS];   // compteurs, un plan de bits par poids
+    uint64_t thr[EXPANDER_DEBOUNCE_BITS];   // seuils, meme disposition
+
+}expander_debounce_t;
+
+void expander_debounce_init(expander_debounce_t*, uint64_t initial, unsigned int stable);
+int expander_debounce_setStable(expander_debounce_t*, int chip, uint8_t pins, unsigned int stable);
+
+uint64_t expander_debounce_feed(expander_debounce_t*, uint64_t raw);
+uint64_t expander_debounce_feedBytes(expander_debounce_t*, const uint8_t *gpio, int n);
+
+uint8_t expander_debounce_get(const expander_debounce_t*, int chip);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
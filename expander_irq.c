@@ -0,0 +1,228 @@
+/**
+ * @file expander_irq.c
+ * @author Hamza RAHAL
+ * @brief  interruptions sur changement d'entree du MCP23008 : configuration
+ *         des registres et attente des fronts de INT sur une ligne GPIO de la RP
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include <poll.h>
+#include <linux/gpio.h>
+#include "expander_irq.h"
+
+
+/**
+ **
+ * @brief   configure l'interruption sur changement pour les pins de mask. Ces
+ *          pins sont reservés en entree (voir expander_setInputPins)
+ *
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   mask pins qui declenchent une interruption (GPINTEN), 0 pour tout couper
+ * @param   intcon bit a 0 : interruption sur tout changement, bit a 1 : sur difference avec defval
+ * @param   defval valeur de comparaison pour les pins dont le bit intcon est a 1
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_setInterrupt(expander_t *exp, uint8_t mask, uint8_t intcon, uint8_t defval){
+
+    if(exp == NULL)
+    {
+        return Er_Expander_Ecriture;
+    }
+
+    expander_lock(exp);
+    int ret = expander_setInputPins(exp, exp->inputs | mask);
+    if(ret < 0){
+        pthread_mutex_unlock(&exp->lock);
+        return ret;
+    }
+
+    if(expander_writeRegister(exp, MCP23008_DEFVAL, defval) < 0 ||
+       expander_writeRegister(exp, REG_INTCON, intcon) < 0 ||
+       expander_writeRegister(exp, MCP23008_GPINTEN, mask) < 0)
+    {
+        pthread_mutex_unlock(&exp->lock);
+        return Er_Ecriture;
+    }
+
+    // acquitte une eventuelle interruption deja en cours
+    uint8_t intcap;
+    ret = expander_readRegister(exp, REG_INTCAP, &intcap);
+    pthread_mutex_unlock(&exp->lock);
+    return ret;
+}
+
+/**
+ **
+ * @brief   lit INTF et INTCAP en un seul transfert (ce qui acquitte l'interruption)
+ *          et remplit l'evenement
+ *
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   ev evenement a remplir
+ * @param   timestamp_ns date du front, 0 pour prendre la date courante
+ *
+ * @return  1 si une interruption etait en cours, 0 sinon, code d'erreur si echec
+ *
+ **/
+int expander_irq_service(expander_t *exp, expander_event_t *ev, uint64_t timestamp_ns){
+
+    struct i2c_msg msgs[4];
+    uint8_t regs[2] = { REG_INTF, REG_INTCAP };
+    uint8_t vals[2];
+
+    if(exp == NULL || ev == NULL)
+        return Er_Expander_Ecriture;
+
+    // selection + lecture de chaque registre, valable quel que soit IOCON.SEQOP
+    for(int i = 0; i < 2; i++){
+
+        msgs[2 * i].addr = exp->addr;
+        msgs[2 * i].flags = 0;
+        msgs[2 * i].len = 1;
+        msgs[2 * i].buf = &regs[i];
+
+        msgs[2 * i + 1].addr = exp->addr;
+        msgs[2 * i + 1].flags = I2C_M_RD;
+        msgs[2 * i + 1].len = 1;
+        msgs[2 * i + 1].buf = &vals[i];
+    }
+
+    if(expander_transfer(exp, msgs, 4) < 0)
+        return Er_Lecture;
+
+    if(timestamp_ns == 0){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    ev->timestamp_ns = timestamp_ns;
+    ev->addr = exp->addr;
+    ev->intf = vals[0];
+    ev->intcap = vals[1];
+    return vals[0] != 0;
+}
+
+/**
+ **
+ * @brief   demande la ligne GPIO de la RP reliée a la sortie INT de l'expander,
+ *          avec detection du front d'activation (selon IOCON.INTPOL)
+ *
+ * @param   exp pointeur sur variable structuré de l'expander
+ * @param   gpiochip chemin du gpiochip (ex: "/dev/gpiochip0")
+ * @param   line numero de la ligne sur ce gpiochip
+ *
+ * @return  la ligne ouverte, NULL si echec
+ *
+ **/
+expander_irq_t* expander_irq_open(expander_t *exp, const char *gpiochip, unsigned int line){
+
+    if(exp == NULL || gpiochip == NULL)
+    {
+        printf("ERREUR fonction %s : parametre NULL\n", __func__);
+        return NULL;
+    }
+
+    uint8_t iocon;
+    if(expander_readRegister(exp, REG_IOCON, &iocon) < 0){
+        printf("ERREUR fonction %s : lecture de IOCON\n", __func__);
+        return NULL;
+    }
+
+    int chip = open(gpiochip, O_RDWR | O_CLOEXEC);
+    if(chip < 0){
+        fprintf(stderr, "fonction %s: Unable to open %s: %s\n", __func__, gpiochip, strerror(errno));
+        return NULL;
+    }
+
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = line;
+    req.num_lines = 1;
+    strncpy(req.consumer, EXPANDER_IRQ_CONSUMER, sizeof(req.consumer) - 1);
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    req.config.flags |= (iocon & IOCON_INTPOL) ? GPIO_V2_LINE_FLAG_EDGE_RISING : GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    if(iocon & IOCON_ODR)
+        req.config.flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+
+    int ret = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req);
+    close(chip);
+    if(ret < 0){
+        fprintf(stderr, "fonction %s: Unable to request line %u: %s\n", __func__, line, strerror(errno));
+        return NULL;
+    }
+
+    expander_irq_t *irq = malloc(sizeof(expander_irq_t));
+    if(irq == NULL){
+        close(req.fd);
+        return NULL;
+    }
+    irq->exp = exp;
+    irq->fd = req.fd;
+    irq->nb_events = 0;
+    irq->nb_spurious = 0;
+
+    // un front deja passé ne sera pas revu : on acquitte ce qui est en attente
+    expander_event_t ev;
+    expander_irq_service(exp, &ev, 0);
+
+    return irq;
+}
+
+/**
+ **
+ * @brief   attend le prochain front de INT puis lit INTF/INTCAP
+ *
+ * @param   irq ligne ouverte par expander_irq_open
+ * @param   ev evenement a remplir
+ * @param   timeout_ms delai maximum, -1 pour attendre indefiniment, 0 pour ne pas attendre
+ *
+ * @return  1 si un evenement a ete delivré, 0 si delai depassé (ou front sans
+ *          interruption en cours), code d'erreur sinon
+ *
+ **/
+int expander_irq_wait(expander_irq_t *irq, expander_event_t *ev, int timeout_ms){
+
+    if(irq == NULL || ev == NULL)
+        return Er_Expander_Ecriture;
+
+    struct pollfd pfd = { .fd = irq->fd, .events = POLLIN };
+
+    int ret = poll(&pfd, 1, timeout_ms);
+    if(ret < 0)
+        return errno == EINTR ? 0 : Er_I2C;
+    if(ret == 0)
+        return 0;
+
+    struct gpio_v2_line_event le;
+    if(read(irq->fd, &le, sizeof(le)) != sizeof(le))
+        return Er_Lecture;
+
+    ret = expander_irq_service(irq->exp, ev, le.timestamp_ns);
+    if(ret < 0)
+        return ret;
+    if(ret == 0){
+        irq->nb_spurious++;
+        return 0;
+    }
+    irq->nb_events++;
+    return 1;
+}
+
+/**
+ **
+ * @brief   libere la ligne GPIO (la configuration d'interruption du MCP est conservée)
+ *
+ **/
+void expander_irq_close(expander_irq_t *irq){
+
+    if(irq == NULL)
+        return;
+    close(irq->fd);
+    free(irq);
+}
@@ -0,0 +1,56 @@
+#ifndef _EXPANDER_IRQ_H
+#define _EXPANDER_IRQ_H
+
+/**
+ * @file expander_irq.h
+ * @author Hamza RAHAL
+ * @brief  interruptions sur changement d'entree (GPINTEN/INTCON/DEFVAL) et
+ *         attente de la sortie INT du MCP23008 via le GPIO character device
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include "MCP23017.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EXPANDER_IRQ_CONSUMER   "mcp23008-int"
+
+/*
+ evenement delivré a chaque front de la ligne INT
+*/
+typedef struct expander_event
+{
+    uint64_t timestamp_ns;      // date du front (CLOCK_MONOTONIC, horodaté par le noyau)
+    uint8_t addr;               // expander a l'origine de l'evenement
+    uint8_t intf;               // pins ayant declenché l'interruption (INTF)
+    uint8_t intcap;             // etat des GPIO capturé au moment de l'interruption (INTCAP)
+
+}expander_event_t;
+
+typedef struct expander_irq
+{
+    expander_t *exp;
+    int fd;                     // descripteur de la ligne GPIO, a surveiller avec poll/epoll
+    uint64_t nb_events;         // evenements delivrés
+    uint64_t nb_spurious;       // fronts sans INTF (interruption deja acquittée)
+
+}expander_irq_t;
+
+int expander_setInterrupt(expander_t*, uint8_t mask, uint8_t intcon, uint8_t defval);
+
+expander_irq_t* expander_irq_open(expander_t*, const char *gpiochip, unsigned int line);
+int expander_irq_wait(expander_irq_t*, expander_event_t*, int timeout_ms);
+int expander_irq_service(expander_t*, expander_event_t*, uint64_t timestamp_ns);
+void expander_irq_close(expander_irq_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * @file expander_pool.c
+ * @author Hamza RAHAL
+ * @brief  un thread par adaptateur, créé a la premiere requete pour ce bus
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include <sys/eventfd.h>
+#include "expander_pool.h"
+
+
+/**
+ **
+ * @brief   cree un pool vide : les threads sont demarrés a la premiere requete
+ *          pour chaque bus
+ *
+ * @param   depth operations en vol par bus, 0 pour EXPANDER_ASYNC_DEPTH
+ *
+ * @return  le pool, NULL si echec
+ *
+ **/
+expander_pool_t* expander_pool_open(unsigned int depth){
+
+    expander_pool_t *pool = calloc(1, sizeof(expander_pool_t));
+    if(pool == NULL){
+        printf("ERREUR %s : allocation echouee\n", __func__);
+        return NULL;
+    }
+
+    pool->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(pool->fd < 0){
+        fprintf(stderr, "fonction %s: Unable to create eventfd: %s\n", __func__, strerror(errno));
+        free(pool);
+        return NULL;
+    }
+    pool->depth = depth;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+/**
+ **
+ * @brief   termine les operations soumises, arrete les threads et rend les bus
+ *
+ **/
+void expander_pool_close(expander_pool_t *pool){
+
+    if(pool == NULL)
+        return;
+
+    for(int i = 0; i < atomic_load(&pool->nb_bus); i++){
+        expander_async_close(pool->as[i]);
+        expander_bus_close(pool->bus[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    close(pool->fd);
+    free(pool);
+}
+
+/**
+ **
+ * @brief   file du bus, créée (avec son thread) au premier appel
+ *
+ * @return  la file, NULL si le pool est plein ou la creation a echoué
+ *
+ **/
+static expander_async_t* pool_get(expander_pool_t *pool, expander_bus_t *bus){
+
+    int n = atomic_load_explicit(&pool->nb_bus, memory_order_acquire);
+    expander_async_t *as = NULL;
+
+    for(int i = 0; i < n; i++){
+        if(pool->bus[i] == bus)
+            return pool->as[i];
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    n = atomic_load_explicit(&pool->nb_bus, memory_order_relaxed);
+    for(int i = 0; i < n && as == NULL; i++){
+        if(pool->bus[i] == bus)
+            as = pool->as[i];
+    }
+    if(as == NULL && n < EXPANDER_POOL_MAX_BUS){
+
+        as = expander_async_openFd(pool->depth, pool->fd);
+        if(as != NULL){
+            expander_bus_ref(bus);
+            pool->bus[n] = bus;
+            pool->as[n] = as;
+            atomic_store_explicit(&pool->nb_bus, n + 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return as;
+}
+
+/**
+ **
+ * @brief   soumet une requete au thread du bus de req->exp, sans bloquer
+ *
+ * @return  0 si ok, Er_Plein si la file de ce bus est pleine, code d'erreur sinon
+ *
+ **/
+int expander_pool_submit(expander_pool_t *pool, expander_req_t *req){
+
+    if(pool == NULL || req == NULL || req->exp == NULL || req->exp->bus == NULL)
+        return Er_Expander_Ecriture;
+
+    expander_async_t *as = pool_get(pool, req->exp->bus);
+    if(as == NULL)
+        return Er_Ouverture;
+    return expander_async_submit(as, req);
+}
+
+/**
+ **
+ * @brief   recupere les requetes terminées (sans rappel) de tous les bus, sans
+ *          bloquer. A appeler quand pool->fd est lisible, depuis un seul thread
+ *
+ * @return  nombre de requetes rendues, Er_Lecture ou Er_Ecriture si l'eventfd
+ *          commun n'a pas pu etre lu ou rearmé et qu'aucune requete n'est rendue
+ *
+ **/
+int expander_pool_reap(expander_pool_t *pool, expander_req_t **reqs, int max){
+
+    int k = 0;
+
+    if(pool == NULL || reqs == NULL)
+        return 0;
+
+    int n = atomic_load_explicit(&pool->nb_bus, memory_order_acquire);
+    for(int i = 0; i < n && k < max; i++){
+
+        int r = expander_async_reap(pool->as[i], reqs + k, max - k);
+        if(r < 0)
+            return k > 0 ? k : r;
+        k += r;
+    }
+
+    // chaque reap vide le compteur commun : on le rearme s'il reste des fins
+    // sur une file, y compris une deja visitée
+    for(int i = 0; i < n; i++){
+
+        expander_async_t *as = pool->as[i];
+        if(atomic_load(&as->cq_head) != atomic_load(&as->cq_tail)){
+
+            uint64_t one = 1;
+            if(write(pool->fd, &one, sizeof(one)) != sizeof(one) && k == 0)
+                return Er_Ecriture;
+            break;
+        }
+    }
+    return k;
+}
@@ -0,0 +1,39 @@
+#ifndef _EXPANDER_POOL_H
+#define _EXPANDER_POOL_H
+
+/**
+ * @file expander_pool.h
+ * @author Hamza RAHAL
+ * @brief  un thread par adaptateur : les requetes asynchrones sont envoyées
+ *         a la file du bus de leur expander, les bus differents travaillent en
+ *         parallele, les fins arrivent sur un seul eventfd
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include "expander_async.h"
+
+#define EXPANDER_POOL_MAX_BUS   8       // adaptateurs servis par un pool
+
+typedef struct expander_pool
+{
+    int fd;                     // eventfd commun des fins, a surveiller avec poll/epoll
+    unsigned int depth;         // profondeur de chaque file
+
+    pthread_mutex_t lock;       // creation des files
+    atomic_int nb_bus;
+    expander_bus_t *bus[EXPANDER_POOL_MAX_BUS];
+    expander_async_t *as[EXPANDER_POOL_MAX_BUS];    // file (et thread) de chaque bus
+
+}expander_pool_t;
+
+expander_pool_t* expander_pool_open(unsigned int depth);
+void expander_pool_close(expander_pool_t*);
+
+int expander_pool_submit(expander_pool_t*, expander_req_t*);
+int expander_pool_reap(expander_pool_t*, expander_req_t **reqs, int max);
+
+#endif
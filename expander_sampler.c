@@ -0,0 +1,345 @@
+/**
+ * @file expander_sampler.c
+ * @author Hamza RAHAL
+ * @brief  echantillonnage des entrees en fond : thread cadencé par timerfd,
+ *         un seul ecrivain par anneau, lecteurs sans verrou qui ecartent les
+ *         echantillons ecrasés pendant leur copie
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include <sys/timerfd.h>
+#include "expander_sampler.h"
+#include "expander_batch.h"
+
+_Static_assert(sizeof(expander_sample_t) == 16, "un echantillon fait 16 octets");
+
+
+static uint64_t sampler_now_ns(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ **
+ * @brief   lit GPIO de tous les expanders : un transfert par bus
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+static int sampler_take(expander_sampler_t *s, expander_sample_t *e){
+
+    expander_batch_t b;
+    int ret = 0;
+
+    expander_batch_init(&b);
+    for(int i = 0; i < s->nb_exp && ret == 0; i++){
+
+        if(b.nmsgs > 0 && b.exp[0]->bus != s->exp[i]->bus)
+            ret = expander_batch_flush(&b);
+        if(ret == 0)
+            ret = expander_batch_read(&b, s->exp[i], REG_GPIO, &e->gpio[i]);
+    }
+    if(ret == 0)
+        ret = expander_batch_flush(&b);
+    return ret;
+}
+
+/**
+ **
+ * @brief   thread d'echantillonnage : une lecture par echeance du timerfd. Les
+ *          echeances sont absolues, un retard ne decale pas les suivantes
+ *
+ **/
+static void* sampler_thread(void *arg){
+
+    expander_sampler_t *s = arg;
+    expander_sample_t e;
+    uint64_t echeances;
+
+    while(!atomic_load(&s->stop)){
+
+        if(read(s->tfd, &echeances, sizeof(echeances)) != sizeof(echeances))
+            continue;
+        if(atomic_load(&s->stop))
+            break;
+        if(echeances > 1)
+            atomic_fetch_add(&s->nb_missed, echeances - 1);
+
+        memset(&e, 0, sizeof(e));
+        e.timestamp_ns = sampler_now_ns();
+
+        int ret = sampler_take(s, &e);
+
+        uint64_t duree = sampler_now_ns() - e.timestamp_ns;
+        if(duree > atomic_load_explicit(&s->max_xfer_ns, memory_order_relaxed))
+            atomic_store_explicit(&s->max_xfer_ns, duree, memory_order_relaxed);
+
+        if(ret < 0){
+            atomic_fetch_add(&s->nb_errors, 1);
+            continue;
+        }
+
+        uint64_t h = atomic_load_explicit(&s->head, memory_order_relaxed);
+        s->ring[h & s->mask] = e;
+        atomic_store_explicit(&s->head, h + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+/**
+ **
+ * @brief   demarre l'echantillonnage de GPIO sur des expanders
+ *
+ * @param   exps expanders a lire (1 a EXPANDER_SAMPLER_MAX_EXP), l'octet i de
+ *          chaque echantillon est GPIO de exps[i]
+ * @param   n nombre d'expanders
+ * @param   rate_hz cadence visée
+ * @param   depth echantillons gardés (arrondi a la puissance de 2 superieure),
+ *          0 pour EXPANDER_SAMPLER_DEPTH
+ *
+ * @return  l'echantillonneur, NULL si echec
+ *
+ **/
+expander_sampler_t* expander_sampler_open(expander_t **exps, int n, unsigned int rate_hz, unsigned int depth){
+
+    struct itimerspec its;
+    uint64_t size = 2;
+
+    if(exps == NULL || n <= 0 || n > EXPANDER_SAMPLER_MAX_EXP || rate_hz == 0)
+        return NULL;
+    for(int i = 0; i < n; i++){
+        if(exps[i] == NULL)
+            return NULL;
+    }
+
+    if(depth == 0)
+        depth = EXPANDER_SAMPLER_DEPTH;
+    while(size < depth)
+        size <<= 1;
+
+    expander_sampler_t *s = calloc(1, sizeof(expander_sampler_t));
+    if(s == NULL){
+        printf("ERREUR %s : allocation echouee\n", __func__);
+        return NULL;
+    }
+    memcpy(s->exp, exps, n * sizeof(expander_t*));
+    s->nb_exp = n;
+    s->period_ns = 1000000000ull / rate_hz;
+    s->mask = size - 1;
+    s->ring = calloc(size, sizeof(expander_sample_t));
+    s->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if(s->ring == NULL || s->tfd < 0)
+        goto erreur;
+
+    s->start_ns = sampler_now_ns();
+    its.it_interval.tv_sec = s->period_ns / 1000000000ull;
+    its.it_interval.tv_nsec = s->period_ns % 1000000000ull;
+    its.it_value.tv_sec = (s->start_ns + s->period_ns) / 1000000000ull;
+    its.it_value.tv_nsec = (s->start_ns + s->period_ns) % 1000000000ull;
+    if(timerfd_settime(s->tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        goto erreur;
+
+    if(pthread_create(&s->thread, NULL, sampler_thread, s) != 0)
+        goto erreur;
+    return s;
+
+erreur:
+    fprintf(stderr, "fonction %s: Unable to start sampler: %s\n", __func__, strerror(errno));
+    if(s->tfd >= 0)
+        close(s->tfd);
+    free(s->ring);
+    free(s);
+    return NULL;
+}
+
+/**
+ **
+ * @brief   arrete le thread (au plus une periode d'attente) et libere tout
+ *
+ **/
+void expander_sampler_close(expander_sampler_t *s){
+
+    if(s == NULL)
+        return;
+
+    atomic_store(&s->stop, 1);
+    pthread_join(s->thread, NULL);
+    close(s->tfd);
+    free(s->ring);
+    free(s);
+}
+
+/**
+ **
+ * @brief   place un lecteur au plus ancien echantillon gardé, ou au prochain
+ *
+ * @param   s echantillonneur
+ * @param   cur lecteur
+ * @param   from_now 1 pour ne lire que les echantillons a venir
+ *
+ **/
+void expander_sampler_cursor(expander_sampler_t *s, expander_sampler_cursor_t *cur, int from_now){
+
+    uint64_t head = atomic_load_explicit(&s->head, memory_order_acquire);
+
+    memset(cur, 0, sizeof(*cur));
+    if(from_now)
+        cur->pos = head;
+    else
+        cur->pos = head > s->mask + 1 ? head - s->mask - 1 : 0;
+}
+
+/**
+ **
+ * @brief   place un lecteur sur le premier echantillon pris a partir de
+ *          timestamp_ns (CLOCK_MONOTONIC)
+ *
+ * @return  0 si ok, Er_Lecture si cette date n'est plus dans l'anneau
+ *
+ **/
+int expander_sampler_seek(expander_sampler_t *s, expander_sampler_cursor_t *cur, uint64_t timestamp_ns){
+
+    uint64_t head = atomic_load_explicit(&s->head, memory_order_acquire);
+    // la plus ancienne peut etre en cours de reecriture, on la saute
+    uint64_t debut = head > s->mask ? head - s->mask : 0;
+    uint64_t bas = debut;
+    uint64_t haut = head;
+
+    memset(cur, 0, sizeof(*cur));
+
+    while(bas < haut){
+
+        uint64_t mil = bas + (haut - bas) / 2;
+        if(s->ring[mil & s->mask].timestamp_ns < timestamp_ns)
+            bas = mil + 1;
+        else
+            haut = mil;
+    }
+    cur->pos = bas;
+
+    // des echantillons plus anciens ont deja été ecrasés
+    if(debut > 0 && bas == debut && s->ring[bas & s->mask].timestamp_ns > timestamp_ns)
+        return Er_Lecture;
+    return 0;
+}
+
+/**
+ **
+ * @brief   copie les echantillons suivants du lecteur, sans bloquer le thread
+ *          d'echantillonnage. Ceux qui ont été ecrasés avant d'etre lus sont
+ *          comptés dans cur->nb_lost
+ *
+ * @param   s echantillonneur
+ * @param   cur lecteur
+ * @param   out recoit les echantillons, du plus ancien au plus recent
+ * @param   max taille de out
+ *
+ * @return  nombre d'echantillons copiés
+ *
+ **/
+int expander_sampler_read(expander_sampler_t *s, expander_sampler_cursor_t *cur, expander_sample_t *out, int max){
+
+    if(s == NULL || cur == NULL || out == NULL || max <= 0)
+        return 0;
+
+    uint64_t depth = s->mask + 1;
+    uint64_t head = atomic_load_explicit(&s->head, memory_order_acquire);
+    uint64_t oldest = head > depth ? head - depth : 0;
+
+    if(cur->pos < oldest){
+        cur->nb_lost += oldest - cur->pos;
+        cur->pos = oldest;
+    }
+
+    uint64_t n = head - cur->pos;
+    if(n > (uint64_t)max)
+        n = max;
+
+    for(uint64_t i = 0; i < n; i++)
+        out[i] = s->ring[(cur->pos + i) & s->mask];
+
+    // le thread a pu repasser sur les plus anciens pendant la copie, et ecrire
+    // l'echantillon apres - depth sans avoir encore avancé head
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t apres = atomic_load_explicit(&s->head, memory_order_relaxed);
+    uint64_t valide = apres + 1 > depth ? apres + 1 - depth : 0;
+    uint64_t perdus = 0;
+
+    if(valide > cur->pos)
+        perdus = valide - cur->pos < n ? valide - cur->pos : n;
+
+    memmove(out, out + perdus, (n - perdus) * sizeof(expander_sample_t));
+    cur->nb_lost += perdus;
+    cur->pos += n;
+
+    if(n > perdus){
+        cur->last = out[n - perdus - 1];
+        cur->has_last = 1;
+    }
+    return n - perdus;
+}
+
+/**
+ **
+ * @brief   comme expander_sampler_read, mais ne rend que les echantillons dont
+ *          un octet differe du precedent (le premier lu est toujours rendu)
+ *
+ * @return  nombre d'echantillons copiés
+ *
+ **/
+int expander_sampler_readChanges(expander_sampler_t *s, expander_sampler_cursor_t *cur, expander_sample_t *out, int max){
+
+    int k = 0;
+
+    if(s == NULL || cur == NULL || out == NULL)
+        return 0;
+
+    while(k < max){
+
+        expander_sample_t prec = cur->last;
+        int has_prec = cur->has_last;
+        int n = expander_sampler_read(s, cur, out + k, max - k);
+        int j = 0;
+
+        if(n <= 0)
+            break;
+
+        for(int i = 0; i < n; i++){
+
+            expander_sample_t *e = &out[k + i];
+
+            if(!has_prec || memcmp(e->gpio, prec.gpio, s->nb_exp) != 0){
+                prec = *e;
+                out[k + j++] = prec;
+            }
+            has_prec = 1;
+        }
+        k += j;
+    }
+    return k;
+}
+
+/**
+ **
+ * @brief   cadence obtenue, echeances manquées et erreurs depuis l'ouverture
+ *
+ **/
+void expander_sampler_getStats(expander_sampler_t *s, expander_sampler_stats_t *st){
+
+    if(s == NULL || st == NULL)
+        return;
+
+    uint64_t duree = sampler_now_ns() - s->start_ns;
+
+    st->nb_samples = atomic_load(&s->head);
+    st->nb_missed = atomic_load(&s->nb_missed);
+    st->nb_errors = atomic_load(&s->nb_errors);
+    st->max_xfer_ns = atomic_load(&s->max_xfer_ns);
+    st->rate_hz = duree ? st->nb_samples * 1e9 / duree : 0;
+}
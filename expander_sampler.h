@@ -0,0 +1,86 @@
+#ifndef _EXPANDER_SAMPLER_H
+#define _EXPANDER_SAMPLER_H
+
+/**
+ * @file expander_sampler.h
+ * @author Hamza RAHAL
+ * @brief  echantillonnage des entrees en fond : un thread cadencé par timerfd
+ *         (sans derive) lit GPIO de plusieurs expanders en un transfert par
+ *         bus et range (date, octets) dans un anneau lu sans verrou
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include <stdatomic.h>
+#include "MCP23017.h"
+
+#define EXPANDER_SAMPLER_MAX_EXP    8       // expanders par echantillonneur (un octet chacun)
+#define EXPANDER_SAMPLER_DEPTH      4096    // echantillons gardés par defaut (puissance de 2)
+
+/*
+ un echantillon : GPIO de chaque expander, dans l'ordre donné a l'ouverture
+*/
+typedef struct expander_sample
+{
+    uint64_t timestamp_ns;                  // CLOCK_MONOTONIC, juste avant le transfert
+    uint8_t gpio[EXPANDER_SAMPLER_MAX_EXP];
+
+}expander_sample_t;
+
+/*
+ position d'un lecteur dans l'anneau : chaque lecteur a la sienne
+*/
+typedef struct expander_sampler_cursor
+{
+    uint64_t pos;               // prochain echantillon a lire
+    uint64_t nb_lost;           // echantillons ecrasés avant d'avoir été lus
+    expander_sample_t last;     // dernier echantillon rendu (readChanges)
+    int has_last;
+
+}expander_sampler_cursor_t;
+
+typedef struct expander_sampler_stats
+{
+    uint64_t nb_samples;        // echantillons pris
+    uint64_t nb_missed;         // echeances manquées (transfert plus long que la periode)
+    uint64_t nb_errors;         // transferts en echec (echantillon non pris)
+    uint64_t max_xfer_ns;       // transfert le plus long
+    double rate_hz;             // cadence obtenue depuis l'ouverture
+
+}expander_sampler_stats_t;
+
+typedef struct expander_sampler
+{
+    expander_t *exp[EXPANDER_SAMPLER_MAX_EXP];
+    int nb_exp;
+    uint64_t period_ns;
+
+    int tfd;                    // timerfd de cadencement
+    atomic_int stop;
+    pthread_t thread;
+
+    expander_sample_t *ring;
+    uint64_t mask;              // profondeur - 1
+    _Atomic uint64_t head;      // echantillons ecrits depuis l'ouverture
+
+    uint64_t start_ns;
+    _Atomic uint64_t nb_missed;
+    _Atomic uint64_t nb_errors;
+    _Atomic uint64_t max_xfer_ns;
+
+}expander_sampler_t;
+
+expander_sampler_t* expander_sampler_open(expander_t **exps, int n, unsigned int rate_hz, unsigned int depth);
+void expander_sampler_close(expander_sampler_t*);
+
+void expander_sampler_cursor(expander_sampler_t*, expander_sampler_cursor_t*, int from_now);
+int expander_sampler_seek(expander_sampler_t*, expander_sampler_cursor_t*, uint64_t timestamp_ns);
+int expander_sampler_read(expander_sampler_t*, expander_sampler_cursor_t*, expander_sample_t *out, int max);
+int expander_sampler_readChanges(expander_sampler_t*, expander_sampler_cursor_t*, expander_sample_t *out, int max);
+
+void expander_sampler_getStats(expander_sampler_t*, expander_sampler_stats_t*);
+
+#endif
@@ -0,0 +1,355 @@
+/**
+ * @file expander_sim.c
+ * @author Hamza RAHAL
+ * @brief  modele logiciel du MCP23008 (banc de registres, pointeur d'adresse,
+ *         mode sequentiel, interruptions) et transport associé
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include <time.h>
+#include "expander_sim.h"
+
+
+/**
+ **
+ * @brief   renvoie la date courante en ns (horloge monotone)
+ *
+ **/
+static uint64_t sim_now_ns(void){
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ **
+ * @brief   renvoie le MCP simulé a l'adresse addr, NULL s'il n'est pas present
+ *
+ **/
+static expander_sim_chip_t* sim_chip(expander_sim_t *sim, uint8_t addr){
+
+    if(addr < 0x20 || addr > 0x27)
+        return NULL;
+    if(!(sim->present & (1 << (addr - 0x20))))
+        return NULL;
+    return &sim->chip[addr - 0x20];
+}
+
+/**
+ **
+ * @brief   valeur du registre GPIO : niveau des pins en entree (corrigé par IPOL)
+ *          et valeur de OLAT pour les pins en sortie
+ *
+ **/
+static uint8_t sim_gpio(expander_sim_chip_t *c){
+
+    uint8_t iodir = c->reg[MCP23008_IODIR];
+
+    return (((c->pins ^ c->reg[MCP23008_IPOL]) & iodir) | (c->reg[REG_OLAT] & ~iodir));
+}
+
+/**
+ **
+ * @brief   logique d'interruption sur changement : compare au GPIO precedent
+ *          (INTCON a 0) ou a DEFVAL (INTCON a 1) pour les pins autorisés par GPINTEN.
+ *          INTF et INTCAP ne sont mis a jour que si aucune interruption n'est en cours
+ *
+ * @param   c MCP simulé
+ * @param   prev valeur de GPIO avant le changement
+ *
+ **/
+static void sim_evalInt(expander_sim_chip_t *c, uint8_t prev){
+
+    uint8_t cur = sim_gpio(c);
+    uint8_t intcon = c->reg[REG_INTCON];
+    uint8_t mask = c->reg[MCP23008_GPINTEN] & c->reg[MCP23008_IODIR];
+    uint8_t fired = mask & (((prev ^ cur) & ~intcon) | ((c->reg[MCP23008_DEFVAL] ^ cur) & intcon));
+
+    if(fired && c->reg[REG_INTF] == 0){
+
+        c->reg[REG_INTF] = fired;
+        c->reg[REG_INTCAP] = cur;
+    }
+}
+
+/**
+ **
+ * @brief   lecture de GPIO ou INTCAP : acquitte l'interruption. En mode
+ *          comparaison a DEFVAL, elle se redeclenche tant que la difference persiste
+ *
+ **/
+static void sim_clearInt(expander_sim_chip_t *c){
+
+    uint8_t cur = sim_gpio(c);
+
+    c->reg[REG_INTF] = 0;
+    sim_evalInt(c, cur);
+}
+
+static uint8_t sim_readReg(expander_sim_chip_t *c, uint8_t reg){
+
+    uint8_t val;
+
+    if(reg >= EXPANDER_SIM_NB_REG)
+        return 0;
+
+    c->nb_read[reg]++;
+    if(reg == REG_GPIO){
+        val = sim_gpio(c);
+        sim_clearInt(c);
+    }
+    else if(reg == REG_INTCAP){
+        val = c->reg[REG_INTCAP];
+        sim_clearInt(c);
+    }
+    else{
+        val = c->reg[reg];
+    }
+    return val;
+}
+
+static void sim_writeReg(expander_sim_chip_t *c, uint8_t reg, uint8_t val){
+
+    if(reg >= EXPANDER_SIM_NB_REG)
+        return;
+
+    c->nb_write[reg]++;
+    switch(reg){
+
+        case REG_INTF:
+        case REG_INTCAP:
+            // registres en lecture seule
+            break;
+        case REG_GPIO:
+            // une ecriture sur GPIO modifie OLAT
+            c->reg[REG_OLAT] = val;
+            break;
+        case REG_IOCON:
+            // bits 7, 6 et 0 non implementés
+            c->reg[REG_IOCON] = val & 0x3E;
+            break;
+        default:
+            c->reg[reg] = val;
+            break;
+    }
+}
+
+/**
+ **
+ * @brief   avance le pointeur d'adresse si le mode sequentiel est actif
+ *          (IOCON.SEQOP a 0), avec retour a 0x00 apres OLAT
+ *
+ **/
+static void sim_nextPtr(expander_sim_chip_t *c){
+
+    if(c->reg[REG_IOCON] & IOCON_SEQOP)
+        return;
+    c->ptr = (c->ptr + 1) % EXPANDER_SIM_NB_REG;
+}
+
+
+
+/**
+ **
+ * @brief   initialise un bus simulé sans aucun MCP
+ *
+ * @param   sim bus simulé
+ * @param   clock_hz horloge du bus a modeliser (100000, 400000...), 0 pour des transferts instantanés
+ *
+ **/
+void expander_sim_init(expander_sim_t *sim, uint32_t clock_hz){
+
+    memset(sim, 0, sizeof(*sim));
+    sim->clock_hz = clock_hz;
+}
+
+/**
+ **
+ * @brief   branche un MCP23008 a l'adresse addr, dans son etat de mise sous tension
+ *
+ **/
+void expander_sim_addChip(expander_sim_t *sim, uint8_t addr){
+
+    if(addr < 0x20 || addr > 0x27)
+        return;
+
+    expander_sim_chip_t *c = &sim->chip[addr - 0x20];
+    memset(c, 0, sizeof(*c));
+    c->reg[MCP23008_IODIR] = 0xFF;
+    sim->present |= 1 << (addr - 0x20);
+}
+
+/**
+ **
+ * @brief   debranche le MCP23008 de l'adresse addr (il ne repond plus)
+ *
+ **/
+void expander_sim_removeChip(expander_sim_t *sim, uint8_t addr){
+
+    if(addr < 0x20 || addr > 0x27)
+        return;
+    sim->present &= ~(1 << (addr - 0x20));
+}
+
+/**
+ **
+ * @brief   acces direct au MCP simulé (registres, compteurs)
+ *
+ **/
+expander_sim_chip_t* expander_sim_getChip(expander_sim_t *sim, uint8_t addr){
+
+    return sim_chip(sim, addr);
+}
+
+/**
+ **
+ * @brief   impose le niveau des pins vus de l'exterieur (seuls les pins en entree sont concernés)
+ *
+ **/
+void expander_sim_setInputs(expander_sim_t *sim, uint8_t addr, uint8_t pins){
+
+    expander_sim_chip_t *c = sim_chip(sim, addr);
+    if(c == NULL)
+        return;
+
+    uint8_t prev = sim_gpio(c);
+    c->pins = pins;
+    sim_evalInt(c, prev);
+}
+
+/**
+ **
+ * @brief   niveau electrique des pins : OLAT pour les sorties, niveau impose pour les entrees
+ *
+ **/
+uint8_t expander_sim_getPins(expander_sim_t *sim, uint8_t addr){
+
+    expander_sim_chip_t *c = sim_chip(sim, addr);
+    if(c == NULL)
+        return 0;
+
+    uint8_t iodir = c->reg[MCP23008_IODIR];
+    return (c->pins & iodir) | (c->reg[REG_OLAT] & ~iodir);
+}
+
+/**
+ **
+ * @brief   etat logique de la sortie INT (1 : interruption en cours)
+ *
+ **/
+int expander_sim_getINT(expander_sim_t *sim, uint8_t addr){
+
+    expander_sim_chip_t *c = sim_chip(sim, addr);
+    if(c == NULL)
+        return 0;
+    return c->reg[REG_INTF] != 0;
+}
+
+/**
+ **
+ * @brief   remet a zero les compteurs du bus et des MCP
+ *
+ **/
+void expander_sim_resetCounters(expander_sim_t *sim){
+
+    sim->nb_xfer = 0;
+    sim->nb_msg = 0;
+    sim->nb_bytes = 0;
+    sim->bus_ns = 0;
+    for(int i = 0; i < EXPANDER_SIM_NB_CHIP; i++){
+        memset(sim->chip[i].nb_read, 0, sizeof(sim->chip[i].nb_read));
+        memset(sim->chip[i].nb_write, 0, sizeof(sim->chip[i].nb_write));
+    }
+}
+
+
+
+static int sim_open(expander_bus_t *bus){
+
+    if(bus->tr_ctx == NULL)
+        return -1;
+    bus->funcs |= I2C_FUNC_PROTOCOL_MANGLING;
+    return 0;
+}
+
+static int sim_close(expander_bus_t *bus){
+
+    (void)bus;
+    return 0;
+}
+
+/**
+ **
+ * @brief   execute les messages sur le bus simulé. Comme le vrai adaptateur, un
+ *          MCP absent (NACK) interrompt le transfert, sauf si le message porte
+ *          I2C_M_IGNORE_NAK (octets lus a 0xFF). Si clock_hz est non nul, le
+ *          temps sur le fil (start, adresse, octets + ACK, stop) est attendu activement
+ *
+ **/
+static int sim_xfer(expander_bus_t *bus, struct i2c_msg *msgs, int nmsgs){
+
+    expander_sim_t *sim = bus->tr_ctx;
+    uint64_t bits = 1;     // STOP final
+    int ret = 0;
+
+    sim->nb_xfer++;
+    for(int i = 0; i < nmsgs; i++){
+
+        expander_sim_chip_t *c = sim_chip(sim, msgs[i].addr);
+
+        sim->nb_msg++;
+        sim->nb_bytes++;
+        bits += 1 + 9;      // (RE)START + adresse + ACK
+        if(c == NULL && !(msgs[i].flags & I2C_M_IGNORE_NAK)){
+            errno = ENXIO;
+            ret = -1;
+            break;
+        }
+
+        sim->nb_bytes += msgs[i].len;
+        bits += 9 * msgs[i].len;
+        if(c == NULL){
+            if(msgs[i].flags & I2C_M_RD)
+                memset(msgs[i].buf, 0xFF, msgs[i].len);
+            continue;
+        }
+        if(msgs[i].flags & I2C_M_RD){
+
+            for(int j = 0; j < msgs[i].len; j++){
+                msgs[i].buf[j] = sim_readReg(c, c->ptr);
+                sim_nextPtr(c);
+            }
+        }
+        else if(msgs[i].len > 0){
+
+            c->ptr = msgs[i].buf[0];
+            for(int j = 1; j < msgs[i].len; j++){
+                sim_writeReg(c, c->ptr, msgs[i].buf[j]);
+                sim_nextPtr(c);
+            }
+        }
+    }
+
+    if(sim->clock_hz){
+
+        uint64_t ns = bits * 1000000000ull / sim->clock_hz;
+        uint64_t end = sim_now_ns() + ns;
+
+        sim->bus_ns += ns;
+        while(sim_now_ns() < end)
+            ;
+    }
+    return ret;
+}
+
+const expander_transport_t expander_transport_sim = {
+    .name = "sim",
+    .open = sim_open,
+    .close = sim_close,
+    .xfer = sim_xfer,
+};
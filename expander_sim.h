@@ -0,0 +1,68 @@
+#ifndef _EXPANDER_SIM_H
+#define _EXPANDER_SIM_H
+
+/**
+ * @file expander_sim.h
+ * @author Hamza RAHAL
+ * @brief  MCP23008 simulé en mémoire, branché derriere expander_transport_sim
+ *         pour mesurer et tester la librairie sans Raspberry Pi
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include "MCP23017.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EXPANDER_SIM_NB_REG     11      // registres 0x00 (IODIR) a 0x0A (OLAT)
+#define EXPANDER_SIM_NB_CHIP    8       // adresses 0x20 a 0x27
+
+typedef struct expander_sim_chip
+{
+    uint8_t reg[EXPANDER_SIM_NB_REG];   // banc de registres
+    uint8_t ptr;                        // pointeur d'adresse interne
+    uint8_t pins;                       // niveau impose de l'exterieur sur les pins en entree
+
+    uint32_t nb_read[EXPANDER_SIM_NB_REG];  // lectures par registre
+    uint32_t nb_write[EXPANDER_SIM_NB_REG]; // ecritures par registre
+
+}expander_sim_chip_t;
+
+typedef struct expander_sim
+{
+    expander_sim_chip_t chip[EXPANDER_SIM_NB_CHIP];
+    uint8_t present;            // bit i a 1 si un MCP repond a l'adresse 0x20+i
+    uint32_t clock_hz;          // horloge du bus modelisée (0 : transferts instantanés)
+
+    uint64_t nb_xfer;           // nombre d'appels au transport (= appels systeme sur le vrai bus)
+    uint64_t nb_msg;            // nombre de messages i2c
+    uint64_t nb_bytes;          // octets sur le fil, octet d'adresse compris
+    uint64_t bus_ns;            // temps passé sur le fil d'apres clock_hz
+
+}expander_sim_t;
+
+extern const expander_transport_t expander_transport_sim;
+
+void expander_sim_init(expander_sim_t*, uint32_t clock_hz);
+
+void expander_sim_addChip(expander_sim_t*, uint8_t addr);
+void expander_sim_removeChip(expander_sim_t*, uint8_t addr);
+
+expander_sim_chip_t* expander_sim_getChip(expander_sim_t*, uint8_t addr);
+
+void expander_sim_setInputs(expander_sim_t*, uint8_t addr, uint8_t pins);
+uint8_t expander_sim_getPins(expander_sim_t*, uint8_t addr);
+int expander_sim_getINT(expander_sim_t*, uint8_t addr);
+
+void expander_sim_resetCounters(expander_sim_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
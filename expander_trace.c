@@ -0,0 +1,313 @@
+/**
+ * @file expander_trace.c
+ * @author Hamza RAHAL
+ * @brief  trace binaire des transferts : un seul ecrivain par anneau (le bus,
+ *         verrou tenu), lecteurs sans verrou qui ecartent les entrees ecrasées
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * Licence Libre
+ *
+ */
+
+#include <sys/mman.h>
+#include "expander_trace.h"
+
+_Static_assert(sizeof(expander_trace_entry_t) == 16, "une entree de trace fait 16 octets");
+
+static const char *trace_reg_name[EXPANDER_NB_REG] = {
+    "IODIR", "IPOL", "GPINTEN", "DEFVAL", "INTCON", "IOCON",
+    "GPPU", "INTF", "INTCAP", "GPIO", "OLAT",
+};
+
+
+
+/**
+ **
+ * @brief   cree un anneau de trace
+ *
+ * @param   file fichier a mapper (conservé apres un plantage), NULL pour un
+ *          anneau en memoire
+ * @param   depth nombre d'entrees (arrondi a la puissance de 2 superieure), 0
+ *          pour EXPANDER_TRACE_DEPTH
+ *
+ * @return  l'anneau, NULL si echec
+ *
+ **/
+expander_trace_t* expander_trace_open(const char *file, unsigned int depth){
+
+    struct timespec mono, real;
+    expander_trace_t *tr;
+    uint32_t size = 2;
+
+    if(depth == 0)
+        depth = EXPANDER_TRACE_DEPTH;
+    while(size < depth)
+        size <<= 1;
+
+    size_t bytes = sizeof(expander_trace_t) + size * sizeof(expander_trace_entry_t);
+
+    if(file != NULL){
+
+        int fd = open(file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0 || ftruncate(fd, bytes) < 0){
+            fprintf(stderr, "fonction %s: Unable to create %s: %s\n", __func__, file, strerror(errno));
+            if(fd >= 0)
+                close(fd);
+            return NULL;
+        }
+        tr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(tr == MAP_FAILED){
+            fprintf(stderr, "fonction %s: Unable to map %s: %s\n", __func__, file, strerror(errno));
+            return NULL;
+        }
+        tr->mapped = 1;
+    }
+    else{
+
+        tr = calloc(1, bytes);
+        if(tr == NULL){
+            printf("ERREUR %s : allocation echouee\n", __func__);
+            return NULL;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+
+    memcpy(tr->magic, EXPANDER_TRACE_MAGIC, sizeof(tr->magic));
+    tr->version = EXPANDER_TRACE_VERSION;
+    tr->depth = size;
+    tr->realtime_offset_ns = (real.tv_sec - mono.tv_sec) * 1000000000ll + (real.tv_nsec - mono.tv_nsec);
+    atomic_init(&tr->head, 0);
+    return tr;
+}
+
+/**
+ **
+ * @brief   libere l'anneau (le fichier mappé reste sur le disque)
+ *
+ **/
+void expander_trace_close(expander_trace_t *tr){
+
+    if(tr == NULL)
+        return;
+
+    if(tr->mapped)
+        munmap(tr, sizeof(expander_trace_t) + tr->depth * sizeof(expander_trace_entry_t));
+    else
+        free(tr);
+}
+
+/**
+ **
+ * @brief   ajoute une entree a l'anneau (un seul ecrivain a la fois)
+ *
+ **/
+static void trace_put(expander_trace_t *tr, const expander_trace_entry_t *e){
+
+    uint64_t h = atomic_load_explicit(&tr->head, memory_order_relaxed);
+
+    tr->entry[h & (tr->depth - 1)] = *e;
+    atomic_store_explicit(&tr->head, h + 1, memory_order_release);
+}
+
+/**
+ **
+ * @brief   note un transfert dans la trace, appelée par expander_bus_transfer
+ *          avec le verrou du bus tenu. Une selection de registre suivie d'une
+ *          lecture a la meme adresse ne fait qu'une entree
+ *
+ * @param   tr anneau
+ * @param   msgs messages du transfert
+ * @param   nmsgs nombre de messages
+ * @param   ret resultat du transport
+ * @param   t0 debut du transfert
+ * @param   t1 fin du transfert
+ *
+ **/
+void expander_trace_record(expander_trace_t *tr, struct i2c_msg *msgs, int nmsgs, int ret,
+                           const struct timespec *t0, const struct timespec *t1){
+
+    expander_trace_entry_t e;
+    uint8_t first = EXPANDER_TRACE_FIRST;
+
+    int64_t ns = (t1->tv_sec - t0->tv_sec) * 1000000000ll + (t1->tv_nsec - t0->tv_nsec);
+
+    e.timestamp_ns = (uint64_t)t0->tv_sec * 1000000000ull + t0->tv_nsec;
+    e.duration_ns = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+
+    for(int i = 0; i < nmsgs; i++){
+
+        struct i2c_msg *m = &msgs[i];
+        uint16_t len;
+
+        e.addr = m->addr;
+        e.flags = first | (ret < 0 ? EXPANDER_TRACE_ERR : 0);
+        first = 0;
+
+        if(!(m->flags & I2C_M_RD) && m->len == 1 && i + 1 < nmsgs
+           && (msgs[i + 1].flags & I2C_M_RD) && msgs[i + 1].addr == m->addr){
+
+            e.reg = m->buf[0];
+            m++;
+            i++;
+            e.flags |= EXPANDER_TRACE_READ;
+            e.val = m->len ? m->buf[0] : 0;
+            len = m->len;
+        }
+        else if(m->flags & I2C_M_RD){
+
+            e.reg = EXPANDER_TRACE_NOREG;
+            e.flags |= EXPANDER_TRACE_READ;
+            e.val = m->len ? m->buf[0] : 0;
+            len = m->len;
+        }
+        else{
+
+            e.reg = m->len ? m->buf[0] : EXPANDER_TRACE_NOREG;
+            e.val = m->len > 1 ? m->buf[1] : 0;
+            len = m->len ? m->len - 1 : 0;
+        }
+        e.flags |= (len > 15 ? 15 : len) << 4;
+
+        trace_put(tr, &e);
+    }
+}
+
+/**
+ **
+ * @brief   copie les entrees valides de l'anneau, de la plus ancienne a la plus
+ *          recente, sans bloquer l'ecrivain : les entrees ecrasées pendant la
+ *          copie sont ecartées
+ *
+ * @param   tr anneau
+ * @param   entries recoit les entrees
+ * @param   max taille de entries (les max plus recentes sont gardées)
+ *
+ * @return  nombre d'entrees copiées
+ *
+ **/
+int expander_trace_snapshot(const expander_trace_t *tr, expander_trace_entry_t *entries, int max){
+
+    if(tr == NULL || entries == NULL || max <= 0)
+        return 0;
+
+    uint64_t fin = atomic_load_explicit(&tr->head, memory_order_acquire);
+    uint64_t debut = fin > tr->depth ? fin - tr->depth : 0;
+
+    if(fin - debut > (uint64_t)max)
+        debut = fin - max;
+
+    for(uint64_t i = debut; i < fin; i++)
+        entries[i - debut] = tr->entry[i & (tr->depth - 1)];
+
+    // l'ecrivain a pu repasser sur les plus anciennes pendant la copie, et
+    // ecrire l'entree apres - depth sans avoir encore avancé head
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t apres = atomic_load_explicit(&tr->head, memory_order_relaxed);
+    uint64_t perdues = 0;
+
+    if(apres + 1 - debut > tr->depth)
+        perdues = apres + 1 - debut - tr->depth;
+    if(perdues >= fin - debut)
+        return 0;
+
+    memmove(entries, entries + perdues, (fin - debut - perdues) * sizeof(expander_trace_entry_t));
+    return fin - debut - perdues;
+}
+
+/**
+ **
+ * @brief   ecrit une copie de l'anneau dans un fichier lisible par
+ *          expander_trace_dump (utile pour un anneau en memoire)
+ *
+ * @return  0 si ok, code d'erreur sinon
+ *
+ **/
+int expander_trace_save(const expander_trace_t *tr, const char *file){
+
+    if(tr == NULL || file == NULL)
+        return Er_Ecriture;
+
+    expander_trace_t *copie = calloc(1, sizeof(expander_trace_t) + tr->depth * sizeof(expander_trace_entry_t));
+    if(copie == NULL)
+        return Er_Ecriture;
+
+    *copie = *tr;
+    copie->mapped = 0;
+    int n = expander_trace_snapshot(tr, copie->entry, tr->depth);
+    atomic_store(&copie->head, n);
+
+    FILE *f = fopen(file, "wb");
+    int ret = 0;
+    if(f == NULL || fwrite(copie, sizeof(expander_trace_t) + tr->depth * sizeof(expander_trace_entry_t), 1, f) != 1){
+        fprintf(stderr, "fonction %s: Unable to write %s: %s\n", __func__, file, strerror(errno));
+        ret = Er_Ecriture;
+    }
+    if(f != NULL)
+        fclose(f);
+    free(copie);
+    return ret;
+}
+
+/**
+ **
+ * @brief   decode l'anneau en texte, une ligne par entree :
+ *          date, duree, adresse, sens, registre, valeur, octets, resultat
+ *
+ * @param   tr anneau
+ * @param   out sortie
+ * @param   last nombre d'entrees les plus recentes a afficher, 0 pour toutes
+ *
+ * @return  nombre d'entrees affichées, code d'erreur si l'anneau est invalide
+ *
+ **/
+int expander_trace_print(const expander_trace_t *tr, FILE *out, int last){
+
+    if(tr == NULL || memcmp(tr->magic, EXPANDER_TRACE_MAGIC, sizeof(tr->magic)) != 0
+       || tr->version != EXPANDER_TRACE_VERSION || tr->depth == 0 || (tr->depth & (tr->depth - 1)))
+        return Er_Lecture;
+
+    if(last <= 0 || (uint32_t)last > tr->depth)
+        last = tr->depth;
+
+    expander_trace_entry_t *e = malloc(last * sizeof(expander_trace_entry_t));
+    if(e == NULL)
+        return Er_Lecture;
+
+    int n = expander_trace_snapshot(tr, e, last);
+
+    fprintf(out, "# %s, %u entrees, %llu entrees notées\n", tr->path, tr->depth,
+            (unsigned long long)atomic_load(&tr->head));
+
+    for(int i = 0; i < n; i++){
+
+        uint64_t t = e[i].timestamp_ns + tr->realtime_offset_ns;
+        time_t s = t / 1000000000ull;
+        struct tm tm;
+        char date[32];
+        char reg[12];
+
+        localtime_r(&s, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+        if(e[i].reg == EXPANDER_TRACE_NOREG)
+            snprintf(reg, sizeof(reg), "-");
+        else if(e[i].reg < EXPANDER_NB_REG)
+            snprintf(reg, sizeof(reg), "%s", trace_reg_name[e[i].reg]);
+        else
+            snprintf(reg, sizeof(reg), "0x%02x", e[i].reg);
+
+        fprintf(out, "%s.%06llu %c %8.1fus 0x%02x %c %-7s 0x%02x %2u %s\n", date,
+                (unsigned long long)(t % 1000000000ull) / 1000,
+                (e[i].flags & EXPANDER_TRACE_FIRST) ? '+' : ' ',
+                e[i].duration_ns / 1000.0, e[i].addr,
+                (e[i].flags & EXPANDER_TRACE_READ) ? 'R' : 'W',
+                reg, e[i].val, e[i].flags >> 4,
+                (e[i].flags & EXPANDER_TRACE_ERR) ? "ERREUR" : "ok");
+    }
+    free(e);
+    return n;
+}
@@ -0,0 +1,72 @@
+#ifndef _EXPANDER_TRACE_H
+#define _EXPANDER_TRACE_H
+
+/**
+ * @file expander_trace.h
+ * @author Hamza RAHAL
+ * @brief  trace binaire de tous les transferts d'un bus : anneau de 16 octets
+ *         par entree, toujours actif, en memoire ou dans un fichier mappé
+ *         (relisible apres un plantage avec expander_trace_dump)
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Saemload (c) 2022
+ *
+ */
+
+#include <stdatomic.h>
+#include "MCP23017.h"
+
+#define EXPANDER_TRACE_MAGIC    "MCPTRACE"
+#define EXPANDER_TRACE_VERSION  1
+#define EXPANDER_TRACE_DEPTH    256     // entrees par defaut (puissance de 2), 4 Ko
+
+#define EXPANDER_TRACE_READ     0x01    // lecture (sinon ecriture)
+#define EXPANDER_TRACE_ERR      0x02    // le transfert a echoué
+#define EXPANDER_TRACE_FIRST    0x04    // premiere entree d'un transfert
+#define EXPANDER_TRACE_NOREG    0xFF    // lecture sans selection de registre
+
+/*
+ une entree par message (ou par paire selection + lecture) : les entrees d'un
+ meme transfert partagent timestamp, duree et resultat
+*/
+typedef struct expander_trace_entry
+{
+    uint64_t timestamp_ns;      // CLOCK_MONOTONIC, debut du transfert
+    uint32_t duration_ns;       // duree du transfert (saturée)
+    uint8_t addr;               // adresse i2c
+    uint8_t reg;                // premier registre, EXPANDER_TRACE_NOREG si aucun
+    uint8_t val;                // premier octet ecrit ou lu
+    uint8_t flags;              // EXPANDER_TRACE_*, nombre d'octets de donnees sur les 4 bits hauts
+
+}expander_trace_entry_t;
+
+/*
+ meme disposition en memoire et dans le fichier : entete puis depth entrees
+*/
+typedef struct expander_trace
+{
+    char magic[8];              // EXPANDER_TRACE_MAGIC
+    uint32_t version;
+    uint32_t depth;             // nombre d'entrees, puissance de 2
+    int64_t realtime_offset_ns; // CLOCK_REALTIME - CLOCK_MONOTONIC a l'ouverture
+    char path[32];              // bus tracé
+    _Atomic uint64_t head;      // entrees ecrites depuis l'ouverture
+    uint32_t mapped;            // 1 si l'anneau est un fichier mappé
+    uint32_t reserved;
+
+    expander_trace_entry_t entry[];
+
+}expander_trace_t;
+
+expander_trace_t* expander_trace_open(const char *file, unsigned int depth);
+void expander_trace_close(expander_trace_t*);
+
+void expander_trace_record(expander_trace_t*, struct i2c_msg *msgs, int nmsgs, int ret,
+                           const struct timespec *t0, const struct timespec *t1);
+
+int expander_trace_snapshot(const expander_trace_t*, expander_trace_entry_t *entries, int max);
+int expander_trace_save(const expander_trace_t*, const char *file);
+int expander_trace_print(const expander_trace_t*, FILE *out, int last);
+
+#endif
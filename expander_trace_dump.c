@@ -0,0 +1,65 @@
+/**
+ * @file expander_trace_dump.c
+ * @author Hamza RAHAL
+ * @brief  decodeur de trace : affiche en texte un fichier de trace, mappé par
+ *         expander_bus_trace (meme pendant que le programme tourne, ou apres un
+ *         plantage) ou ecrit par expander_trace_save
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * usage : expander_trace_dump [-n dernieres_entrees] fichier
+ *
+ * Licence Libre
+ *
+ */
+
+#include <sys/mman.h>
+#include "expander_trace.h"
+
+
+int main(int argc, char **argv){
+
+    int last = 0;
+    int opt;
+    struct stat st;
+
+    while((opt = getopt(argc, argv, "n:")) != -1){
+        switch(opt){
+            case 'n': last = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage : %s [-n dernieres_entrees] fichier\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(optind >= argc){
+        fprintf(stderr, "usage : %s [-n dernieres_entrees] fichier\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) < 0){
+        fprintf(stderr, "%s : %s\n", argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if((size_t)st.st_size < sizeof(expander_trace_t)){
+        fprintf(stderr, "%s : fichier trop court\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    expander_trace_t *tr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(tr == MAP_FAILED){
+        fprintf(stderr, "%s : %s\n", argv[optind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if(sizeof(expander_trace_t) + (size_t)tr->depth * sizeof(expander_trace_entry_t) > (size_t)st.st_size
+       || expander_trace_print(tr, stdout, last) < 0){
+        fprintf(stderr, "%s : pas une trace MCP23008 (version %d attendue)\n", argv[optind], EXPANDER_TRACE_VERSION);
+        munmap(tr, st.st_size);
+        return EXIT_FAILURE;
+    }
+
+    munmap(tr, st.st_size);
+    return EXIT_SUCCESS;
+}